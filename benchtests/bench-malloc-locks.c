@@ -0,0 +1,24 @@
+/* Benchmark malloc and free functions, counting arena lock acquisitions.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Same as bench-malloc-thread, but also reports how many times malloc and
+   free locked an arena per million allocations, as counted by
+   malloc_info.  Every lock acquisition is a replicated operation under an
+   MVEE.  */
+#define REPORT_LOCKS 1
+#include "bench-malloc-thread.c"
@@ -17,6 +17,7 @@
    <https://www.gnu.org/licenses/>.  */
 
 #include <errno.h>
+#include <malloc.h>
 #include <math.h>
 #include <pthread.h>
 #include <signal.h>
@@ -214,6 +215,34 @@ do_benchmark (size_t num_threads, size_t *iters)
   return elapsed;
 }
 
+#ifdef REPORT_LOCKS
+/* Return the number of times any arena was locked to allocate or free
+   memory so far, or 0 if malloc_info does not say.  */
+static double
+arena_lock_count (void)
+{
+  char *buf = NULL, *p, *last = NULL;
+  size_t size;
+  double count = 0;
+  FILE *fp = open_memstream (&buf, &size);
+
+  if (fp == NULL)
+    return 0;
+
+  malloc_info (0, fp);
+  fclose (fp);
+
+  /* The last count is the total over all arenas.  */
+  for (p = buf; (p = strstr (p, "<locks count=\"")) != NULL; p++)
+    last = p;
+  if (last != NULL)
+    count = strtod (last + strlen ("<locks count=\""), NULL);
+
+  free (buf);
+  return count;
+}
+#endif
+
 static void usage(const char *name)
 {
   fprintf (stderr, "%s: <num_threads>\n", name);
@@ -265,10 +294,18 @@ main (int argc, char **argv)
 
   sigaction (SIGALRM, &act, NULL);
 
+#ifdef REPORT_LOCKS
+  double locks = arena_lock_count ();
+#endif
+
   alarm (BENCHMARK_DURATION);
 
   cur = do_benchmark (num_threads, &iters);
 
+#ifdef REPORT_LOCKS
+  locks = arena_lock_count () - locks;
+#endif
+
   struct rusage usage;
   getrusage(RUSAGE_SELF, &usage);
 
@@ -279,6 +316,10 @@ main (int argc, char **argv)
   json_attr_double (&json_ctx, "iterations", d_total_i);
   json_attr_double (&json_ctx, "time_per_iteration", d_total_s / d_total_i);
   json_attr_double (&json_ctx, "max_rss", usage.ru_maxrss);
+#ifdef REPORT_LOCKS
+  json_attr_double (&json_ctx, "locks", locks);
+  json_attr_double (&json_ctx, "locks_per_million", locks * 1e6 / d_total_i);
+#endif
 
   json_attr_double (&json_ctx, "threads", num_threads);
   json_attr_double (&json_ctx, "min_size", MIN_ALLOCATION_SIZE);
@@ -0,0 +1,181 @@
+/* Benchmark pthread_cond_wait/pthread_cond_signal round trips.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Pairs of threads pass a token back and forth through a mutex and a
+   condition variable, so every round trip involves a wake-up and the
+   condvar's replicated atomics.  Every pair does a fixed number of round
+   trips, so all variants do the same work, as mvee-standin requires.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+/* Round trips per pair of threads.  */
+#define NUM_ROUNDS	20000
+
+struct pair
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* The index of the thread that has the token.  */
+  int turn;
+  timing_t elapsed[2];
+};
+
+struct thread_args
+{
+  struct pair *pair;
+  int self;
+};
+
+static void *
+benchmark_thread (void *arg)
+{
+  struct thread_args *args = (struct thread_args *) arg;
+  struct pair *pair = args->pair;
+  timing_t start, stop;
+
+  TIMING_NOW (start);
+  for (size_t i = 0; i < NUM_ROUNDS; i++)
+    {
+      pthread_mutex_lock (&pair->lock);
+      while (pair->turn != args->self)
+	pthread_cond_wait (&pair->cond, &pair->lock);
+      pair->turn = !args->self;
+      pthread_cond_signal (&pair->cond);
+      pthread_mutex_unlock (&pair->lock);
+    }
+  TIMING_NOW (stop);
+
+  TIMING_DIFF (pair->elapsed[args->self], start, stop);
+
+  return NULL;
+}
+
+static timing_t
+do_benchmark (size_t num_pairs, size_t *iters)
+{
+  timing_t elapsed = 0;
+  struct pair pairs[num_pairs];
+  struct thread_args args[num_pairs * 2];
+  pthread_t threads[num_pairs * 2];
+
+  for (size_t i = 0; i < num_pairs; i++)
+    {
+      pthread_mutex_init (&pairs[i].lock, NULL);
+      pthread_cond_init (&pairs[i].cond, NULL);
+      pairs[i].turn = 0;
+    }
+
+  for (size_t i = 0; i < num_pairs * 2; i++)
+    {
+      args[i].pair = &pairs[i / 2];
+      args[i].self = i % 2;
+      pthread_create (&threads[i], NULL, benchmark_thread, &args[i]);
+    }
+
+  for (size_t i = 0; i < num_pairs * 2; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Both threads of a pair take part in every round trip, so we count
+     the round trips once, and take the time of the thread that finished
+     last.  */
+  for (size_t i = 0; i < num_pairs; i++)
+    {
+      timing_t pair_elapsed = pairs[i].elapsed[0];
+      if (pairs[i].elapsed[1] > pair_elapsed)
+	pair_elapsed = pairs[i].elapsed[1];
+      TIMING_ACCUM (elapsed, pair_elapsed);
+      pthread_cond_destroy (&pairs[i].cond);
+      pthread_mutex_destroy (&pairs[i].lock);
+    }
+
+  *iters = num_pairs * NUM_ROUNDS;
+  return elapsed;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "%s: <num_threads>\n", name);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  timing_t cur;
+  size_t iters = 0, num_threads = 2;
+  json_ctx_t json_ctx;
+  double d_total_s, d_total_i;
+
+  if (argc == 2)
+    {
+      long ret;
+
+      errno = 0;
+      ret = strtol (argv[1], NULL, 10);
+
+      if (errno || ret <= 0)
+	usage (argv[0]);
+
+      num_threads = ret;
+    }
+  else if (argc != 1)
+    usage (argv[0]);
+
+  /* We need at least one pair.  */
+  if (num_threads < 2)
+    num_threads = 2;
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+
+  json_attr_object_begin (&json_ctx, "pthread_cond_wait");
+
+  json_attr_object_begin (&json_ctx, "ping_pong");
+
+  cur = do_benchmark (num_threads / 2, &iters);
+
+  d_total_s = cur;
+  d_total_i = iters;
+
+  json_attr_double (&json_ctx, "duration", d_total_s);
+  json_attr_double (&json_ctx, "iterations", d_total_i);
+  json_attr_double (&json_ctx, "time_per_iteration", d_total_s / d_total_i);
+  json_attr_double (&json_ctx, "threads", num_threads / 2 * 2);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  return 0;
+}
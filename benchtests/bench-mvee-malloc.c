@@ -0,0 +1,173 @@
+/* Benchmark malloc and free in several threads at once.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Every thread replaces random blocks in a working set of its own, which
+   exercises the arena locks, the tcache and, now and then, the creation of
+   new heaps.  Under an MVEE, all of these are replicated.  Unlike
+   bench-malloc-thread, every thread does a fixed number of iterations and
+   the sizes come from a per-thread pseudo-random sequence, so all variants
+   do the same work, as mvee-standin requires.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+/* Iterations per thread.  */
+#define NUM_ITERS	500000
+
+/* Blocks in the working set of each thread.  */
+#define WORKING_SET	256
+
+/* Maximum block size.  One in 64 blocks is up to 16 times larger.  */
+#define MAX_SIZE	1024
+
+struct thread_args
+{
+  uint32_t seed;
+  timing_t elapsed;
+};
+
+static uint32_t
+next_random (uint32_t *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
+static void *
+benchmark_thread (void *arg)
+{
+  struct thread_args *args = (struct thread_args *) arg;
+  void *blocks[WORKING_SET] = { NULL };
+  uint32_t state = args->seed;
+  timing_t start, stop;
+
+  TIMING_NOW (start);
+  for (size_t i = 0; i < NUM_ITERS; i++)
+    {
+      uint32_t r = next_random (&state);
+      size_t idx = r % WORKING_SET;
+      size_t size = 1 + (r >> 8) % MAX_SIZE;
+
+      if ((r >> 20) % 64 == 0)
+	size *= 16;
+
+      free (blocks[idx]);
+      blocks[idx] = malloc (size);
+    }
+  TIMING_NOW (stop);
+
+  for (size_t i = 0; i < WORKING_SET; i++)
+    free (blocks[i]);
+
+  TIMING_DIFF (args->elapsed, start, stop);
+
+  return NULL;
+}
+
+static timing_t
+do_benchmark (size_t num_threads, size_t *iters)
+{
+  timing_t elapsed = 0;
+  struct thread_args args[num_threads];
+  pthread_t threads[num_threads];
+
+  for (size_t i = 0; i < num_threads; i++)
+    {
+      args[i].seed = i + 1;
+      pthread_create (&threads[i], NULL, benchmark_thread, &args[i]);
+    }
+
+  for (size_t i = 0; i < num_threads; i++)
+    {
+      pthread_join (threads[i], NULL);
+      TIMING_ACCUM (elapsed, args[i].elapsed);
+    }
+
+  *iters = num_threads * NUM_ITERS;
+  return elapsed;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "%s: <num_threads>\n", name);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  timing_t cur;
+  size_t iters = 0, num_threads = 1;
+  json_ctx_t json_ctx;
+  double d_total_s, d_total_i;
+
+  if (argc == 2)
+    {
+      long ret;
+
+      errno = 0;
+      ret = strtol (argv[1], NULL, 10);
+
+      if (errno || ret <= 0)
+	usage (argv[0]);
+
+      num_threads = ret;
+    }
+  else if (argc != 1)
+    usage (argv[0]);
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+
+  json_attr_object_begin (&json_ctx, "malloc");
+
+  json_attr_object_begin (&json_ctx, "threads");
+
+  cur = do_benchmark (num_threads, &iters);
+
+  d_total_s = cur;
+  d_total_i = iters;
+
+  json_attr_double (&json_ctx, "duration", d_total_s);
+  json_attr_double (&json_ctx, "iterations", d_total_i);
+  json_attr_double (&json_ctx, "time_per_iteration", d_total_s / d_total_i);
+  json_attr_double (&json_ctx, "threads", num_threads);
+  json_attr_double (&json_ctx, "max_size", MAX_SIZE * 16);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/* Benchmark contended pthread_mutex_lock throughput.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* All threads hammer a single mutex, so every lock and unlock goes through
+   the same replicated atomics.  When run as the leader variant under an
+   MVEE, the time per iteration measures the leader-side cost of the sync
+   agent's clocks and replication buffer.  Every thread does a fixed number
+   of iterations, so that all variants do the same work, which
+   mvee-standin requires.
+
+   The timed variant goes through pthread_mutex_timedlock, and thus the
+   clocklock path of the low-level lock.  Both variants check the counter
+   afterwards, so that a run with glibc.mvee.lock_replication=1 under
+   mvee-standin also tests lock-level replication.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+/* Iterations per thread.  */
+#define NUM_ITERS	1000000
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile unsigned long shared_counter;
+
+static size_t
+mutex_benchmark_loop (void)
+{
+  for (size_t i = 0; i < NUM_ITERS; i++)
+    {
+      pthread_mutex_lock (&lock);
+      shared_counter++;
+      pthread_mutex_unlock (&lock);
+    }
+
+  return NUM_ITERS;
+}
+
+static size_t
+mutex_timed_benchmark_loop (void)
+{
+  /* Far enough ahead that it never expires.  */
+  struct timespec deadline;
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 3600;
+
+  for (size_t i = 0; i < NUM_ITERS; i++)
+    {
+      if (pthread_mutex_timedlock (&lock, &deadline) != 0)
+	abort ();
+      shared_counter++;
+      pthread_mutex_unlock (&lock);
+    }
+
+  return NUM_ITERS;
+}
+
+struct thread_args
+{
+  bool timed;
+  size_t iters;
+  timing_t elapsed;
+};
+
+static void *
+benchmark_thread (void *arg)
+{
+  struct thread_args *args = (struct thread_args *) arg;
+  timing_t start, stop;
+
+  TIMING_NOW (start);
+  args->iters = (args->timed
+		 ? mutex_timed_benchmark_loop () : mutex_benchmark_loop ());
+  TIMING_NOW (stop);
+
+  TIMING_DIFF (args->elapsed, start, stop);
+
+  return NULL;
+}
+
+static timing_t
+do_benchmark (size_t num_threads, bool timed, size_t *iters)
+{
+  timing_t elapsed = 0;
+  struct thread_args args[num_threads];
+  pthread_t threads[num_threads];
+
+  *iters = 0;
+  shared_counter = 0;
+
+  for (size_t i = 0; i < num_threads; i++)
+    {
+      args[i].timed = timed;
+      pthread_create (&threads[i], NULL, benchmark_thread, &args[i]);
+    }
+
+  for (size_t i = 0; i < num_threads; i++)
+    {
+      pthread_join (threads[i], NULL);
+      TIMING_ACCUM (elapsed, args[i].elapsed);
+      *iters += args[i].iters;
+    }
+
+  if (shared_counter != *iters)
+    {
+      fprintf (stderr, "lost updates: counter %lu after %zu iterations\n",
+	       shared_counter, *iters);
+      exit (1);
+    }
+
+  return elapsed;
+}
+
+static void
+run_benchmark (json_ctx_t *json_ctx, const char *name, size_t num_threads,
+	       bool timed)
+{
+  size_t iters = 0;
+  timing_t cur;
+  double d_total_s, d_total_i;
+
+  json_attr_object_begin (json_ctx, name);
+
+  json_attr_object_begin (json_ctx, "contended");
+
+  cur = do_benchmark (num_threads, timed, &iters);
+
+  d_total_s = cur;
+  d_total_i = iters;
+
+  json_attr_double (json_ctx, "duration", d_total_s);
+  json_attr_double (json_ctx, "iterations", d_total_i);
+  json_attr_double (json_ctx, "time_per_iteration", d_total_s / d_total_i);
+  json_attr_double (json_ctx, "threads", num_threads);
+
+  json_attr_object_end (json_ctx);
+
+  json_attr_object_end (json_ctx);
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "%s: <num_threads>\n", name);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t num_threads = 1;
+  json_ctx_t json_ctx;
+
+  if (argc == 2)
+    {
+      long ret;
+
+      errno = 0;
+      ret = strtol (argv[1], NULL, 10);
+
+      if (errno || ret <= 0)
+	usage (argv[0]);
+
+      num_threads = ret;
+    }
+  else if (argc != 1)
+    usage (argv[0]);
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+
+  run_benchmark (&json_ctx, "pthread_mutex_lock", num_threads, false);
+  run_benchmark (&json_ctx, "pthread_mutex_timedlock", num_threads, true);
+
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/* Benchmark the cost of the MVEE hooks outside the monitor.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Times uncontended operations whose fast paths consist of a few libc
+   atomics or a single string function call.  Natively, the atomics and the
+   string functions should not call into the sync agent at all, so the
+   results should match those of an unmodified glibc 2.31 on the same
+   machine.  */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+#define NUM_ITERS 10000000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_spinlock_t spin;
+static sem_t sem;
+static char src[64] = "the quick brown fox jumps over the lazy dog";
+static char dst[64];
+/* Keeps the compiler from expanding the string functions inline.  */
+static volatile size_t len = 32;
+
+static void
+do_mutex (void)
+{
+  pthread_mutex_lock (&mutex);
+  pthread_mutex_unlock (&mutex);
+}
+
+static void
+do_spin (void)
+{
+  pthread_spin_lock (&spin);
+  pthread_spin_unlock (&spin);
+}
+
+static void
+do_sem (void)
+{
+  sem_post (&sem);
+  sem_trywait (&sem);
+}
+
+static void
+do_memcpy (void)
+{
+  memcpy (dst, src, len);
+}
+
+static void
+do_strlen (void)
+{
+  dst[0] = strlen (src + (len & 1));
+}
+
+static const struct
+{
+  const char *name;
+  void (*fn) (void);
+} benchmarks[] =
+{
+  { "pthread_mutex_lock", do_mutex },
+  { "pthread_spin_lock", do_spin },
+  { "sem_post", do_sem },
+  { "memcpy", do_memcpy },
+  { "strlen", do_strlen },
+};
+
+int
+main (void)
+{
+  json_ctx_t json_ctx;
+  timing_t start, stop, cur;
+
+  pthread_spin_init (&spin, PTHREAD_PROCESS_PRIVATE);
+  sem_init (&sem, 0, 0);
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+
+  for (size_t i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++)
+    {
+      json_attr_object_begin (&json_ctx, benchmarks[i].name);
+      json_attr_object_begin (&json_ctx, "uncontended");
+
+      TIMING_NOW (start);
+      for (size_t j = 0; j < NUM_ITERS; j++)
+	benchmarks[i].fn ();
+      TIMING_NOW (stop);
+
+      TIMING_DIFF (cur, start, stop);
+
+      json_attr_double (&json_ctx, "duration", cur);
+      json_attr_double (&json_ctx, "iterations", NUM_ITERS);
+      json_attr_double (&json_ctx, "time_per_iteration",
+			(double) cur / NUM_ITERS);
+
+      json_attr_object_end (&json_ctx);
+      json_attr_object_end (&json_ctx);
+    }
+
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  return 0;
+}
@@ -0,0 +1,200 @@
+/* Benchmark producer/consumer ring buffers guarded by semaphores.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Pairs of threads stream items through a bounded ring buffer.  The
+   producer waits for a free slot and the consumer for a full one, each
+   on a semaphore, so every item costs four replicated atomics and the
+   occasional futex wake-up.  This is the pattern of a thread pool's work
+   queue.  With glibc.mvee.ring_buffers=1, the replication buffers
+   themselves are rings too.  Every pair streams a fixed number of items,
+   so all variants do the same work, as mvee-standin requires.  */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+/* Items per pair of threads.  */
+#define NUM_ITEMS	500000
+
+/* Slots in each ring.  */
+#define RING_SIZE	64
+
+struct ring
+{
+  sem_t free_slots;
+  sem_t full_slots;
+  unsigned long slots[RING_SIZE];
+  unsigned long sum;
+  timing_t elapsed;
+};
+
+static void *
+producer_thread (void *arg)
+{
+  struct ring *ring = (struct ring *) arg;
+
+  for (unsigned long i = 0; i < NUM_ITEMS; i++)
+    {
+      sem_wait (&ring->free_slots);
+      ring->slots[i % RING_SIZE] = i;
+      sem_post (&ring->full_slots);
+    }
+
+  return NULL;
+}
+
+static void *
+consumer_thread (void *arg)
+{
+  struct ring *ring = (struct ring *) arg;
+  unsigned long sum = 0;
+  timing_t start, stop;
+
+  TIMING_NOW (start);
+  for (unsigned long i = 0; i < NUM_ITEMS; i++)
+    {
+      sem_wait (&ring->full_slots);
+      sum += ring->slots[i % RING_SIZE];
+      sem_post (&ring->free_slots);
+    }
+  TIMING_NOW (stop);
+
+  ring->sum = sum;
+  TIMING_DIFF (ring->elapsed, start, stop);
+
+  return NULL;
+}
+
+static timing_t
+do_benchmark (size_t num_pairs, size_t *iters)
+{
+  timing_t elapsed = 0;
+  struct ring *rings = calloc (num_pairs, sizeof (struct ring));
+  pthread_t threads[num_pairs * 2];
+
+  if (rings == NULL)
+    {
+      perror ("calloc");
+      exit (1);
+    }
+
+  for (size_t i = 0; i < num_pairs; i++)
+    {
+      sem_init (&rings[i].free_slots, 0, RING_SIZE);
+      sem_init (&rings[i].full_slots, 0, 0);
+    }
+
+  for (size_t i = 0; i < num_pairs; i++)
+    {
+      pthread_create (&threads[2 * i], NULL, consumer_thread, &rings[i]);
+      pthread_create (&threads[2 * i + 1], NULL, producer_thread, &rings[i]);
+    }
+
+  for (size_t i = 0; i < num_pairs * 2; i++)
+    pthread_join (threads[i], NULL);
+
+  for (size_t i = 0; i < num_pairs; i++)
+    {
+      if (rings[i].sum != (unsigned long) NUM_ITEMS * (NUM_ITEMS - 1) / 2)
+	{
+	  fprintf (stderr, "ring %zu lost items\n", i);
+	  exit (1);
+	}
+      TIMING_ACCUM (elapsed, rings[i].elapsed);
+      sem_destroy (&rings[i].free_slots);
+      sem_destroy (&rings[i].full_slots);
+    }
+
+  free (rings);
+
+  *iters = num_pairs * NUM_ITEMS;
+  return elapsed;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "%s: <num_threads>\n", name);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  timing_t cur;
+  size_t iters = 0, num_threads = 2;
+  json_ctx_t json_ctx;
+  double d_total_s, d_total_i;
+
+  if (argc == 2)
+    {
+      long ret;
+
+      errno = 0;
+      ret = strtol (argv[1], NULL, 10);
+
+      if (errno || ret <= 0)
+	usage (argv[0]);
+
+      num_threads = ret;
+    }
+  else if (argc != 1)
+    usage (argv[0]);
+
+  /* We need at least one producer and one consumer.  */
+  if (num_threads < 2)
+    num_threads = 2;
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+
+  json_attr_object_begin (&json_ctx, "sem_wait");
+
+  json_attr_object_begin (&json_ctx, "ring");
+
+  cur = do_benchmark (num_threads / 2, &iters);
+
+  d_total_s = cur;
+  d_total_i = iters;
+
+  json_attr_double (&json_ctx, "duration", d_total_s);
+  json_attr_double (&json_ctx, "iterations", d_total_i);
+  json_attr_double (&json_ctx, "time_per_iteration", d_total_s / d_total_i);
+  json_attr_double (&json_ctx, "threads", num_threads / 2 * 2);
+  json_attr_double (&json_ctx, "ring_size", RING_SIZE);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  return 0;
+}
@@ -0,0 +1,161 @@
+/* Benchmark the store equivalence check of the MVEE SHM agent.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Followers compare every SHM store against the leader's with
+   __mvee_find_mismatch.  This times each implementation the IFUNC can
+   select, on equal buffers (the common case) and on buffers that differ
+   in one word per 512 bytes, as they do when the data contains pointers
+   into the variants' own address spaces.  The results are the check
+   throughput of a follower, in bytes per time unit.  */
+
+#include <ifunc-impl-list.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-timing.h"
+#include "json-lib.h"
+
+#define MAX_SIZE (1 << 20)
+#define TOTAL_BYTES (1ul << 31)
+#define POINTER_STRIDE 512
+
+typedef size_t (*proto_t) (const void *, const void *, size_t);
+
+static struct libc_ifunc_impl impls[8];
+static unsigned char *buf1;
+static unsigned char *buf2;
+
+static const size_t sizes[] = { 8, 64, 512, 4096, 65536, MAX_SIZE };
+
+/* Calls FN the way mvee_assert_same_store does: after each mismatch, skip
+   the differing word and look for the next one.  */
+static size_t
+check (proto_t fn, size_t size)
+{
+  size_t offset = fn (buf1, buf2, size);
+  size_t mismatches = 0;
+
+  while (offset < size)
+    {
+      mismatches++;
+      offset = (offset & ~(sizeof (void *) - 1)) + sizeof (void *);
+      if (offset >= size)
+	break;
+      offset += fn (buf1 + offset, buf2 + offset, size - offset);
+    }
+
+  return mismatches;
+}
+
+static void
+do_one (json_ctx_t *json_ctx, proto_t fn, size_t size)
+{
+  timing_t start, stop, cur;
+  size_t iters = TOTAL_BYTES / size;
+  volatile size_t sink;
+
+  sink = check (fn, size);
+
+  TIMING_NOW (start);
+  for (size_t i = 0; i < iters; i++)
+    sink = check (fn, size);
+  TIMING_NOW (stop);
+
+  TIMING_DIFF (cur, start, stop);
+  (void) sink;
+
+  json_element_object_begin (json_ctx);
+  json_attr_uint (json_ctx, "size", size);
+  json_attr_double (json_ctx, "duration", cur);
+  json_attr_double (json_ctx, "iterations", iters);
+  json_attr_double (json_ctx, "bytes_per_time_unit",
+		    (double) size * iters / cur);
+  json_element_object_end (json_ctx);
+}
+
+static void
+do_set (json_ctx_t *json_ctx, int count, const char *set)
+{
+  json_attr_object_begin (json_ctx, set);
+
+  for (int i = 0; i < count; i++)
+    {
+      if (!impls[i].usable)
+	continue;
+
+      json_array_begin (json_ctx, impls[i].name);
+      for (size_t j = 0; j < sizeof (sizes) / sizeof (sizes[0]); j++)
+	do_one (json_ctx, (proto_t) impls[i].fn, sizes[j]);
+      json_array_end (json_ctx);
+    }
+
+  json_attr_object_end (json_ctx);
+}
+
+int
+main (void)
+{
+  json_ctx_t json_ctx;
+  int count;
+
+  count = __libc_ifunc_impl_list ("__mvee_find_mismatch", impls,
+				  sizeof (impls) / sizeof (impls[0]));
+  if (count <= 0)
+    {
+      fprintf (stderr, "no implementations of __mvee_find_mismatch\n");
+      return 1;
+    }
+
+  buf1 = malloc (MAX_SIZE);
+  buf2 = malloc (MAX_SIZE);
+  if (buf1 == NULL || buf2 == NULL)
+    {
+      perror ("malloc");
+      return 1;
+    }
+
+  for (size_t i = 0; i < MAX_SIZE; i++)
+    buf1[i] = buf2[i] = i * 7;
+
+  json_init (&json_ctx, 0, stdout);
+
+  json_document_begin (&json_ctx);
+
+  json_attr_string (&json_ctx, "timing_type", TIMING_TYPE);
+
+  json_attr_object_begin (&json_ctx, "functions");
+  json_attr_object_begin (&json_ctx, "mvee_assert_same_store");
+
+  do_set (&json_ctx, count, "equal");
+
+  for (size_t i = POINTER_STRIDE / 2; i < MAX_SIZE; i += POINTER_STRIDE)
+    buf2[i] ^= 0x40;
+
+  do_set (&json_ctx, count, "pointers");
+
+  json_attr_object_end (&json_ctx);
+  json_attr_object_end (&json_ctx);
+
+  json_document_end (&json_ctx);
+
+  free (buf1);
+  free (buf2);
+
+  return 0;
+}
@@ -0,0 +1,923 @@
+/* Stand-in for the MVEE, for running the MVEE benchmarks locally.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Usage: mvee-standin [-n VARIANTS] [-b BUFFER_SIZE] [-a] PROGRAM [ARGS...]
+
+   Starts VARIANTS copies of PROGRAM (2 by default) and services the fake
+   syscalls that the synchronization agents in csu/mvee-*-agent.c issue,
+   so that the agents replicate and check synchronization operations as
+   they would under GHUMVEE.  The fake syscalls are trapped through seccomp
+   user notification, which needs Linux 5.0 or later.  The replication
+   buffers are SysV shared memory segments of BUFFER_SIZE bytes (1 MiB by
+   default).  Variant 0 is the leader.
+
+   Unlike the real monitor, the stand-in neither runs the variants in
+   lockstep nor replicates syscall results.  Every variant must therefore
+   do exactly the same work: a program that runs for a fixed time rather
+   than a fixed number of iterations will deadlock.  Threads are matched
+   across variants in the order in which they were created, which holds
+   as long as a single thread creates all the others.  Forks and the SHM
+   agent are not supported: the SHM agent relies on the monitor to tag
+   shared mappings.  The kernel rejects MVEE_FUTEX_WAIT_TID, so
+   pthread_join spins instead of sleeping.
+
+   Only the leader's output is kept, unless -a is given.  The exit status
+   is that of the leader, or 1 if the variants diverged or crashed.  */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#if defined __x86_64__
+# define STANDIN_AUDIT_ARCH		AUDIT_ARCH_X86_64
+# define MVEE_FAKE_SYSCALL_BASE		0x6FFFFFFF
+#elif defined __arm__
+# define STANDIN_AUDIT_ARCH		AUDIT_ARCH_ARM
+# define MVEE_FAKE_SYSCALL_BASE		0x6FF
+#endif
+
+#if defined STANDIN_AUDIT_ARCH && defined SECCOMP_FILTER_FLAG_NEW_LISTENER
+
+/* Keep these in sync with sysdeps/<arch>/atomic-machine.h.  */
+# define MVEE_GET_MASTERTHREAD_ID	(MVEE_FAKE_SYSCALL_BASE + 3)
+# define MVEE_GET_SHARED_BUFFER		(MVEE_FAKE_SYSCALL_BASE + 4)
+# define MVEE_FLUSH_SHARED_BUFFER	(MVEE_FAKE_SYSCALL_BASE + 5)
+# define MVEE_RUNS_UNDER_MVEE_CONTROL	(MVEE_FAKE_SYSCALL_BASE + 9)
+# define MVEE_GET_THREAD_NUM		(MVEE_FAKE_SYSCALL_BASE + 10)
+# define MVEE_ALL_HEAPS_ALIGNED		(MVEE_FAKE_SYSCALL_BASE + 13)
+# define MVEE_GET_VIRTUALIZED_ARGV0	(MVEE_FAKE_SYSCALL_BASE + 17)
+# define MVEE_GET_LEADER_SHM_TAG	(MVEE_FAKE_SYSCALL_BASE + 20)
+# define MVEE_GET_THREAD_CONTROL	(MVEE_FAKE_SYSCALL_BASE + 23)
+# define MVEE_LIBC_LOCK_BUFFER		3
+# define MVEE_LIBC_ATOMIC_BUFFER	13
+# define MVEE_LIBC_LOCK_BUFFER_PARTIAL	16
+# define MVEE_SHM_BUFFER		23
+
+/* The agents report divergences with gettid (1337, 10000001, code, ...).  */
+# define MVEE_DIVERGENCE_MAGIC		1337
+
+# define MAX_VARIANTS			16
+# define MAX_THREADS			4096
+
+/* How long the other variants get to finish after the first one has
+   exited.  */
+# define GRACE_PERIOD			10
+
+struct request
+{
+  int variant;
+  pid_t tid;
+  int thread;
+  unsigned long seq;
+  __u64 id;
+  int nr;
+  __u64 args[6];
+};
+
+struct variant
+{
+  pid_t pid;
+  int listener;
+  bool exited;
+  int status;
+  /* Thread ids, by thread index.  */
+  pid_t tids[MAX_THREADS];
+  unsigned int nthreads;
+  /* The number of rendezvous calls per thread, and for the process as a
+     whole.  */
+  unsigned long calls[MAX_THREADS];
+  unsigned long process_calls;
+};
+
+/* Keep this in sync with csu/mvee-thread-control.h.  The agent fills in
+   the fields up to master_thread_id, we fill in the rest.  */
+struct thread_control
+{
+  unsigned int version;
+  unsigned int size;
+  uintptr_t clocks;
+  uintptr_t queue_pos;
+  long master_thread_id;
+  struct
+  {
+    long id;
+    unsigned long size;
+  } buffers[2];
+};
+
+# define THREAD_CONTROL_VERSION		1
+# define THREAD_ATOMIC_BUFFER		0
+# define THREAD_SHM_BUFFER		1
+
+struct buffer
+{
+  unsigned long type;
+  bool eip;
+  /* -1 for buffers that are shared by all threads.  */
+  int thread;
+  int id;
+  char *mem;
+  size_t size;
+  /* The number of bytes at the start of the buffer we preserve on
+     flushes.  */
+  size_t header;
+};
+
+/* Calls that complete once every variant has made them.  */
+struct rendezvous
+{
+  bool used;
+  int nr;
+  int thread;
+  unsigned long seq;
+  unsigned int arrived;
+  struct request reqs[MAX_VARIANTS];
+};
+
+static struct variant variants[MAX_VARIANTS];
+static unsigned int nvariants = 2;
+static size_t buffer_size = 1 << 20;
+
+static struct buffer *buffers;
+static size_t nbuffers;
+static struct rendezvous *rendezvous;
+static size_t nrendezvous;
+/* Requests that wait for a leader thread we haven't seen yet.  */
+static struct request *deferred;
+static size_t ndeferred;
+
+static struct seccomp_notif_sizes notif_sizes;
+
+static void __attribute__ ((noreturn))
+kill_variants (int status)
+{
+  for (unsigned int i = 0; i < nvariants; i++)
+    if (!variants[i].exited)
+      kill (variants[i].pid, SIGKILL);
+  exit (status);
+}
+
+static void *
+xrealloc (void *p, size_t size)
+{
+  p = realloc (p, size);
+  if (p == NULL)
+    {
+      perror ("mvee-standin: realloc");
+      kill_variants (1);
+    }
+  return p;
+}
+
+static int
+compare_tids (const void *a, const void *b)
+{
+  return *(const pid_t *) a - *(const pid_t *) b;
+}
+
+/* Gives the threads of V that we haven't seen before an index, in the
+   order in which they were created.  */
+static void
+scan_threads (struct variant *v)
+{
+  char path[64];
+  pid_t found[MAX_THREADS];
+  size_t nfound = 0;
+  struct dirent *d;
+  DIR *dir;
+
+  snprintf (path, sizeof (path), "/proc/%d/task", (int) v->pid);
+  dir = opendir (path);
+  if (dir == NULL)
+    return;
+
+  while ((d = readdir (dir)) != NULL && nfound < MAX_THREADS)
+    {
+      pid_t tid = atoi (d->d_name);
+      bool known = false;
+
+      if (tid <= 0)
+	continue;
+      for (unsigned int i = 0; i < v->nthreads && !known; i++)
+	known = v->tids[i] == tid;
+      if (!known)
+	found[nfound++] = tid;
+    }
+  closedir (dir);
+
+  qsort (found, nfound, sizeof (pid_t), compare_tids);
+  for (size_t i = 0; i < nfound && v->nthreads < MAX_THREADS; i++)
+    v->tids[v->nthreads++] = found[i];
+}
+
+static int
+find_thread (struct variant *v, pid_t tid)
+{
+  for (unsigned int i = 0; i < v->nthreads; i++)
+    if (v->tids[i] == tid)
+      return i;
+  return -1;
+}
+
+static int
+thread_index (struct variant *v, pid_t tid)
+{
+  int idx = find_thread (v, tid);
+
+  if (idx < 0)
+    {
+      scan_threads (v);
+      idx = find_thread (v, tid);
+    }
+  if (idx < 0)
+    {
+      fprintf (stderr, "mvee-standin: too many threads in variant %d\n",
+	       (int) (v - variants));
+      kill_variants (1);
+    }
+  return idx;
+}
+
+static void
+write_variant (pid_t tid, __u64 addr, const void *val, size_t size)
+{
+  struct iovec local = { (void *) val, size };
+  struct iovec remote = { (void *) (uintptr_t) addr, size };
+
+  if (addr != 0 && process_vm_writev (tid, &local, 1, &remote, 1, 0) < 0)
+    perror ("mvee-standin: process_vm_writev");
+}
+
+static bool
+read_variant (pid_t tid, __u64 addr, void *val, size_t size)
+{
+  struct iovec local = { val, size };
+  struct iovec remote = { (void *) (uintptr_t) addr, size };
+
+  if (process_vm_readv (tid, &local, 1, &remote, 1, 0) < 0)
+    {
+      perror ("mvee-standin: process_vm_readv");
+      return false;
+    }
+  return true;
+}
+
+static void
+respond (const struct request *req, long val, int error)
+{
+  struct seccomp_notif_resp *resp = alloca (notif_sizes.seccomp_notif_resp);
+
+  memset (resp, 0, notif_sizes.seccomp_notif_resp);
+  resp->id = req->id;
+  resp->val = val;
+  resp->error = error ? -error : 0;
+
+  /* ENOENT means the thread has died in the meantime.  */
+  if (ioctl (variants[req->variant].listener, SECCOMP_IOCTL_NOTIF_SEND,
+	     resp) < 0 && errno != ENOENT)
+    perror ("mvee-standin: SECCOMP_IOCTL_NOTIF_SEND");
+}
+
+static struct buffer *
+find_buffer (unsigned long type, bool eip, int thread)
+{
+  for (size_t i = 0; i < nbuffers; i++)
+    if (buffers[i].type == type && buffers[i].eip == eip
+	&& buffers[i].thread == thread)
+      return &buffers[i];
+  return NULL;
+}
+
+static bool
+buffer_is_per_thread (unsigned long type)
+{
+  return type == MVEE_LIBC_ATOMIC_BUFFER || type == MVEE_SHM_BUFFER;
+}
+
+/* Returns the buffer of TYPE for THREAD, and sets it up if it doesn't
+   exist yet.  Returns NULL and sets errno if we can't.  */
+static struct buffer *
+get_buffer (unsigned long type, bool eip, int thread, size_t size,
+	    size_t header)
+{
+  struct buffer *buf = find_buffer (type, eip, thread);
+
+  if (buf != NULL)
+    return buf;
+
+  int id = shmget (IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (id < 0)
+    {
+      perror ("mvee-standin: shmget");
+      return NULL;
+    }
+
+  /* Attach the segment ourselves so we can clear it on flushes, and so it
+     goes away with us.  */
+  char *mem = shmat (id, NULL, 0);
+  shmctl (id, IPC_RMID, NULL);
+  if (mem == (void *) -1)
+    {
+      perror ("mvee-standin: shmat");
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  buffers = xrealloc (buffers, (nbuffers + 1) * sizeof (*buffers));
+  buf = &buffers[nbuffers++];
+  *buf = (struct buffer) { type, eip, thread, id, mem, size, header };
+  return buf;
+}
+
+/* MVEE_GET_SHARED_BUFFER (ptr, type, size_ptr, arg3, arg4).  A PTR of 1
+   asks for the call stack buffer that goes with the lock buffer.  If
+   SIZE_PTR is set, we pick the size and store it there.  Otherwise ARG3 is
+   the size.  The total/partial agent passes the size of a lock buffer
+   entry in ARG3, and keeps NVARIANTS entries' worth of bookkeeping at the
+   start of the buffer.  */
+static void
+get_shared_buffer (const struct request *req)
+{
+  unsigned long type = req->args[1];
+  bool eip = req->args[0] == 1;
+  size_t size = req->args[2] ? buffer_size : req->args[3];
+  size_t header = 0;
+
+  if (!eip && (type == MVEE_LIBC_LOCK_BUFFER
+	       || type == MVEE_LIBC_LOCK_BUFFER_PARTIAL))
+    header = nvariants * req->args[3];
+
+  struct buffer *buf = get_buffer (type, eip,
+				   buffer_is_per_thread (type)
+				   ? req->thread : -1, size, header);
+  if (buf == NULL)
+    {
+      respond (req, 0, errno);
+      return;
+    }
+
+  if (req->args[2])
+    {
+      unsigned long size = buf->size;
+      write_variant (req->tid, req->args[2], &size, sizeof (size));
+    }
+
+  respond (req, buf->id, 0);
+}
+
+/* Completes a rendezvous once every variant has arrived.  */
+static void
+complete_rendezvous (struct rendezvous *r)
+{
+  long val = 0;
+
+  if (r->nr == MVEE_FLUSH_SHARED_BUFFER)
+    {
+      unsigned long type = r->reqs[0].args[0];
+      struct buffer *buf = find_buffer (type, false,
+					buffer_is_per_thread (type)
+					? r->thread : -1);
+
+      /* Everyone is waiting for us, so nobody touches the buffer.  */
+      if (buf != NULL)
+	memset (buf->mem + buf->header, 0, buf->size - buf->header);
+    }
+  else if (r->nr == MVEE_ALL_HEAPS_ALIGNED)
+    {
+      /* ALL_HEAPS_ALIGNED (heap, alignment, size) */
+      val = 1;
+      for (unsigned int i = 0; i < nvariants; i++)
+	if (r->reqs[i].args[0] & (r->reqs[i].args[1] - 1))
+	  val = 0;
+    }
+
+  for (unsigned int i = 0; i < nvariants; i++)
+    respond (&r->reqs[i], val, 0);
+  r->used = false;
+}
+
+/* Calls that the monitor only completes when every variant has made them.
+   We match the calls up by the thread that made them, and by the number
+   of such calls that thread has made so far.  The total/partial agent
+   flushes the lock buffer from whichever thread finds it full, so those
+   flushes are matched up per process instead.  */
+static void
+join_rendezvous (struct request *req)
+{
+  struct variant *v = &variants[req->variant];
+  struct rendezvous *r = NULL;
+  size_t i;
+
+  if (req->nr == MVEE_FLUSH_SHARED_BUFFER
+      && !buffer_is_per_thread (req->args[0]))
+    {
+      req->thread = -1;
+      req->seq = v->process_calls++;
+    }
+  else
+    req->seq = v->calls[req->thread]++;
+
+  for (i = 0; i < nrendezvous; i++)
+    if (rendezvous[i].used && rendezvous[i].nr == req->nr
+	&& rendezvous[i].thread == req->thread
+	&& rendezvous[i].seq == req->seq)
+      {
+	r = &rendezvous[i];
+	break;
+      }
+
+  if (r == NULL)
+    {
+      for (i = 0; i < nrendezvous && rendezvous[i].used; i++)
+	;
+      if (i == nrendezvous)
+	{
+	  rendezvous = xrealloc (rendezvous,
+				 ++nrendezvous * sizeof (*rendezvous));
+	}
+      r = &rendezvous[i];
+      memset (r, 0, sizeof (*r));
+      r->used = true;
+      r->nr = req->nr;
+      r->thread = req->thread;
+      r->seq = req->seq;
+    }
+
+  r->reqs[req->variant] = *req;
+  if (++r->arrived == nvariants)
+    complete_rendezvous (r);
+}
+
+/* Returns the id of the leader's thread with index THREAD, or 0 if the
+   leader doesn't have that thread yet.  */
+static pid_t
+leader_tid (int thread)
+{
+  struct variant *leader = &variants[0];
+
+  if (thread >= leader->nthreads)
+    scan_threads (leader);
+  if (thread >= leader->nthreads)
+    return 0;
+  return leader->tids[thread];
+}
+
+/* Returns false if the leader doesn't have a thread with the same index
+   yet.  */
+static bool
+get_masterthread_id (const struct request *req)
+{
+  pid_t tid = leader_tid (req->thread);
+
+  if (tid == 0)
+    return false;
+  respond (req, tid, 0);
+  return true;
+}
+
+/* MVEE_GET_THREAD_CONTROL (control, control_size, state, state_size).  We
+   set up the WoC agent's queue if the agent passed its clocks, and leave
+   the SHM agent's buffer to MVEE_GET_SHARED_BUFFER.  Since we don't support
+   forks, we don't clear STATE in children.  Returns false if the leader
+   doesn't have a thread with the same index yet.  */
+static bool
+get_thread_control (const struct request *req)
+{
+  struct thread_control control;
+  pid_t tid = leader_tid (req->thread);
+
+  if (tid == 0)
+    return false;
+
+  if (req->args[1] != sizeof (control)
+      || !read_variant (req->tid, req->args[0], &control, sizeof (control))
+      || control.version != THREAD_CONTROL_VERSION)
+    {
+      respond (req, 0, EINVAL);
+      return true;
+    }
+
+  control.master_thread_id = tid;
+  control.buffers[THREAD_ATOMIC_BUFFER].id = -1;
+  control.buffers[THREAD_SHM_BUFFER].id = -1;
+  if (control.clocks != 0)
+    {
+      struct buffer *buf = get_buffer (MVEE_LIBC_ATOMIC_BUFFER, false,
+				       req->thread, buffer_size, 0);
+      if (buf != NULL)
+	{
+	  control.buffers[THREAD_ATOMIC_BUFFER].id = buf->id;
+	  control.buffers[THREAD_ATOMIC_BUFFER].size = buf->size;
+	}
+    }
+
+  write_variant (req->tid,
+		 req->args[0] + offsetof (struct thread_control,
+					  master_thread_id),
+		 &control.master_thread_id,
+		 sizeof (control) - offsetof (struct thread_control,
+					      master_thread_id));
+  respond (req, 0, 0);
+  return true;
+}
+
+/* Answers a request that might have to wait for the leader.  */
+static bool
+get_thread_info (const struct request *req)
+{
+  if (req->nr == MVEE_GET_THREAD_CONTROL)
+    return get_thread_control (req);
+  return get_masterthread_id (req);
+}
+
+static void
+report_divergence (const struct request *req)
+{
+  fprintf (stderr, "mvee-standin: variant %d, thread %d diverged: "
+	   "error %lld (%#llx, %#llx, %#llx)\n", req->variant, req->thread,
+	   (long long) req->args[2], (unsigned long long) req->args[3],
+	   (unsigned long long) req->args[4],
+	   (unsigned long long) req->args[5]);
+  kill_variants (1);
+}
+
+static void
+handle_request (struct request *req)
+{
+  pid_t tid = req->tid;
+
+  req->thread = thread_index (&variants[req->variant], tid);
+
+  if (req->nr == __NR_gettid)
+    report_divergence (req);
+
+  switch (req->nr)
+    {
+    case MVEE_RUNS_UNDER_MVEE_CONTROL:
+      {
+	/* (&sync_enabled, &infinite_loop, &num_variants, &variant_num,
+	    &master_variant, &shm_tag) */
+	unsigned char sync_enabled = 1;
+	unsigned short num = nvariants, variant_num = req->variant;
+	unsigned char master = req->variant == 0;
+	unsigned long shm_tag = 0;
+
+	write_variant (tid, req->args[0], &sync_enabled, sizeof (sync_enabled));
+	write_variant (tid, req->args[2], &num, sizeof (num));
+	write_variant (tid, req->args[3], &variant_num, sizeof (variant_num));
+	write_variant (tid, req->args[4], &master, sizeof (master));
+	write_variant (tid, req->args[5], &shm_tag, sizeof (shm_tag));
+	respond (req, 0, 0);
+	break;
+      }
+    case MVEE_GET_SHARED_BUFFER:
+      get_shared_buffer (req);
+      break;
+    case MVEE_FLUSH_SHARED_BUFFER:
+    case MVEE_ALL_HEAPS_ALIGNED:
+      join_rendezvous (req);
+      break;
+    case MVEE_GET_MASTERTHREAD_ID:
+    case MVEE_GET_THREAD_CONTROL:
+      if (!get_thread_info (req))
+	{
+	  deferred = xrealloc (deferred, ++ndeferred * sizeof (*deferred));
+	  deferred[ndeferred - 1] = *req;
+	}
+      break;
+    case MVEE_GET_THREAD_NUM:
+      respond (req, req->thread, 0);
+      break;
+    case MVEE_GET_LEADER_SHM_TAG:
+      respond (req, 0, 0);
+      break;
+    case MVEE_GET_VIRTUALIZED_ARGV0:
+      respond (req, 0, ENOSYS);
+      break;
+    default:
+      /* Calls that only tell the monitor something.  */
+      if (req->nr > MVEE_FAKE_SYSCALL_BASE
+	  && req->nr <= MVEE_FAKE_SYSCALL_BASE + 22)
+	respond (req, 0, 0);
+      else
+	respond (req, 0, ENOSYS);
+      break;
+    }
+}
+
+static void
+receive_request (unsigned int variant)
+{
+  struct seccomp_notif *notif = alloca (notif_sizes.seccomp_notif);
+  struct request req;
+
+  memset (notif, 0, notif_sizes.seccomp_notif);
+  if (ioctl (variants[variant].listener, SECCOMP_IOCTL_NOTIF_RECV,
+	     notif) < 0)
+    {
+      if (errno != EINTR && errno != ENOENT)
+	perror ("mvee-standin: SECCOMP_IOCTL_NOTIF_RECV");
+      return;
+    }
+
+  memset (&req, 0, sizeof (req));
+  req.variant = variant;
+  req.tid = notif->pid;
+  req.id = notif->id;
+  req.nr = notif->data.nr;
+  memcpy (req.args, notif->data.args, sizeof (req.args));
+  handle_request (&req);
+}
+
+static void
+retry_deferred (void)
+{
+  size_t kept = 0;
+
+  for (size_t i = 0; i < ndeferred; i++)
+    if (!get_thread_info (&deferred[i]))
+      deferred[kept++] = deferred[i];
+  ndeferred = kept;
+}
+
+static int
+send_fd (int sock, int fd)
+{
+  char cbuf[CMSG_SPACE (sizeof (int))];
+  char dummy = 0;
+  struct iovec iov = { &dummy, 1 };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+			.msg_control = cbuf, .msg_controllen = sizeof (cbuf) };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+  return sendmsg (sock, &msg, 0);
+}
+
+static int
+receive_fd (int sock)
+{
+  char cbuf[CMSG_SPACE (sizeof (int))];
+  char dummy;
+  struct iovec iov = { &dummy, 1 };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+			.msg_control = cbuf, .msg_controllen = sizeof (cbuf) };
+  struct cmsghdr *cmsg;
+  int fd;
+
+  if (recvmsg (sock, &msg, 0) <= 0)
+    return -1;
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+  memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+  return fd;
+}
+
+/* Traps the fake syscalls, and the gettid calls with which the agents
+   report divergences.  Everything else runs natively.  */
+static struct sock_filter filter[] =
+{
+  BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offsetof (struct seccomp_data, arch)),
+  BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, STANDIN_AUDIT_ARCH, 1, 0),
+  BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offsetof (struct seccomp_data, nr)),
+  BPF_JUMP (BPF_JMP | BPF_JGE | BPF_K, MVEE_FAKE_SYSCALL_BASE, 4, 0),
+  BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, __NR_gettid, 0, 2),
+  BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offsetof (struct seccomp_data, args[0])),
+  BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, MVEE_DIVERGENCE_MAGIC, 1, 0),
+  BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+};
+
+static pid_t
+start_variant (unsigned int num, char **argv, bool keep_output)
+{
+  struct sock_fprog prog = { sizeof (filter) / sizeof (filter[0]), filter };
+  int socks[2];
+  pid_t pid;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, socks) < 0)
+    {
+      perror ("mvee-standin: socketpair");
+      kill_variants (1);
+    }
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      perror ("mvee-standin: fork");
+      kill_variants (1);
+    }
+
+  if (pid == 0)
+    {
+      close (socks[0]);
+      if (num > 0 && !keep_output)
+	{
+	  int null = open ("/dev/null", O_WRONLY);
+	  dup2 (null, STDOUT_FILENO);
+	  dup2 (null, STDERR_FILENO);
+	  close (null);
+	}
+
+      int fd = -1;
+      if (prctl (PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0)
+	fd = syscall (__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+		      SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+      if (fd < 0)
+	{
+	  perror ("mvee-standin: seccomp");
+	  _exit (127);
+	}
+      send_fd (socks[1], fd);
+      close (fd);
+      close (socks[1]);
+
+      execvp (argv[0], argv);
+      perror ("mvee-standin: exec");
+      _exit (127);
+    }
+
+  close (socks[1]);
+  variants[num].pid = pid;
+  variants[num].listener = receive_fd (socks[0]);
+  close (socks[0]);
+  if (variants[num].listener < 0)
+    {
+      fprintf (stderr, "mvee-standin: variant %u didn't start\n", num);
+      kill_variants (1);
+    }
+
+  return pid;
+}
+
+/* Returns the number of variants that are still running.  */
+static unsigned int
+reap_variants (void)
+{
+  unsigned int running = 0;
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    for (unsigned int i = 0; i < nvariants; i++)
+      if (variants[i].pid == pid)
+	{
+	  variants[i].exited = true;
+	  variants[i].status = status;
+	  close (variants[i].listener);
+	  if (WIFSIGNALED (status))
+	    {
+	      fprintf (stderr, "mvee-standin: variant %u died with signal %d\n",
+		       i, WTERMSIG (status));
+	      kill_variants (1);
+	    }
+	}
+
+  for (unsigned int i = 0; i < nvariants; i++)
+    running += !variants[i].exited;
+  return running;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "usage: %s [-n variants] [-b buffer_size] [-a] "
+	   "program [args...]\n", name);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  bool keep_output = false;
+  time_t first_exit = 0;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "+n:b:a")) != -1)
+    switch (opt)
+      {
+      case 'n':
+	nvariants = atoi (optarg);
+	if (nvariants < 1 || nvariants > MAX_VARIANTS)
+	  usage (argv[0]);
+	break;
+      case 'b':
+	buffer_size = strtoul (optarg, NULL, 0);
+	if (buffer_size < 4096)
+	  usage (argv[0]);
+	break;
+      case 'a':
+	keep_output = true;
+	break;
+      default:
+	usage (argv[0]);
+      }
+
+  if (optind >= argc)
+    usage (argv[0]);
+
+  if (syscall (__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &notif_sizes) < 0)
+    {
+      perror ("mvee-standin: seccomp user notification is not supported");
+      return 1;
+    }
+
+  for (unsigned int i = 0; i < nvariants; i++)
+    start_variant (i, &argv[optind], keep_output);
+
+  while (reap_variants () > 0)
+    {
+      struct pollfd fds[MAX_VARIANTS];
+
+      for (unsigned int i = 0; i < nvariants && first_exit == 0; i++)
+	if (variants[i].exited)
+	  first_exit = time (NULL);
+      if (first_exit != 0 && time (NULL) - first_exit > GRACE_PERIOD)
+	{
+	  fprintf (stderr, "mvee-standin: not all variants exited\n");
+	  kill_variants (1);
+	}
+
+      for (unsigned int i = 0; i < nvariants; i++)
+	{
+	  fds[i].fd = variants[i].exited ? -1 : variants[i].listener;
+	  fds[i].events = POLLIN;
+	  fds[i].revents = 0;
+	}
+
+      if (poll (fds, nvariants, ndeferred ? 1 : 100) < 0 && errno != EINTR)
+	{
+	  perror ("mvee-standin: poll");
+	  kill_variants (1);
+	}
+
+      for (unsigned int i = 0; i < nvariants; i++)
+	if (fds[i].revents & POLLIN)
+	  receive_request (i);
+
+      if (ndeferred)
+	retry_deferred ();
+    }
+
+  for (unsigned int i = 1; i < nvariants; i++)
+    if (variants[i].status != variants[0].status)
+      {
+	fprintf (stderr, "mvee-standin: variant %u exited with status %d, "
+		 "the leader with %d\n", i, WEXITSTATUS (variants[i].status),
+		 WEXITSTATUS (variants[0].status));
+	return 1;
+      }
+
+  return WEXITSTATUS (variants[0].status);
+}
+
+#else
+
+int
+main (void)
+{
+  fprintf (stderr, "mvee-standin: not supported on this system\n");
+  return 1;
+}
+
+#endif
@@ -293,8 +293,10 @@ LIBC_START_MAIN (int (*main) (int, char **, char ** MAIN_AUXVEC_DECL),
 #endif
 
 #ifdef USE_MVEE_LIBC
-  (void) syscall(MVEE_RUNS_UNDER_MVEE_CONTROL, &mvee_sync_enabled, &mvee_infinite_loop, 
-				 &mvee_num_variants, NULL, &mvee_master_variant, &mvee_shm_tag);
+  /* Usually answered already by the string function resolvers.  This also
+     turns the inline MVEE hooks off if we're running natively.  */
+  (void) mvee_detect_monitor ();
+  mvee_agent_init ();
 
 #ifdef EXPOSE_MEMCPY_TO_DYNINST
   extern uint64_t mvee_shm_memcpy_ptr_for_gs_segment;
@@ -6,9 +6,52 @@ extern unsigned char                  mvee_master_variant;
 extern unsigned char                  mvee_sync_enabled;
 extern unsigned long                  mvee_shm_tag;
 extern unsigned short                 mvee_num_variants;
+extern unsigned short                 mvee_my_variant_num;
+extern unsigned char                  mvee_ring_buffers;
+extern unsigned char                  mvee_private_memory;
+extern unsigned char                  mvee_load_replication;
+extern unsigned char                  mvee_lock_replication;
+extern unsigned char                  mvee_shm_write_combining;
+extern unsigned int                   mvee_shm_check_window;
+extern unsigned char                  mvee_shm_deferred_ops;
+extern unsigned char                  mvee_shm_syscall_hook;
+extern unsigned char                  mvee_wait_policy;
+extern unsigned int                   mvee_spin_count;
+extern unsigned int                   mvee_yield_count;
+extern unsigned int                   mvee_call_site_checks;
+extern unsigned char                  mvee_check_level;
+extern unsigned char                  mvee_hooks_enabled;
+
+//
+// Follower wait policies, selected at startup through glibc.mvee.wait_policy.
+// All variants must use the same policy since the leader only issues futex
+// wakes in MVEE_WAIT_ADAPTIVE mode.
+//
+enum mvee_wait_policies
+{
+  MVEE_WAIT_SPIN     = 0, // busy-wait on arch_cpu_relax()
+  MVEE_WAIT_YIELD    = 1, // sched_yield between polls (the old MVEE_SLAVE_YIELD)
+  MVEE_WAIT_ADAPTIVE = 2  // bounded spin, then yield, then futex wait
+};
+
+//
+// Consistency checks in the followers, selected at startup through
+// glibc.mvee.check_level. Every level includes the checks of the levels below.
+//
+enum mvee_check_levels
+{
+  MVEE_CHECK_OFF       = 0, // no checks beyond glibc.mvee.call_site_checks
+  MVEE_CHECK_OP_TYPE   = 1, // check the type and the word of every operation (the old MVEE_CHECK_LOCK_TYPE)
+  MVEE_CHECK_CALL_SITE = 2, // check the call site of every operation
+  MVEE_CHECK_FULL      = 3  // log stack traces (the old MVEE_LOG_EIPS) and check the agent's own state
+};
 
 extern void mvee_infinite_loop(void);
+extern void mvee_agent_init(void);
+extern unsigned char mvee_detect_monitor(void) attribute_hidden;
 extern void* mvee_shm_decode_address(const volatile void* address);
+extern void mvee_shm_complete_deferred_ops(void) attribute_hidden;
+extern void mvee_shm_thread_teardown(void) attribute_hidden;
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
@@ -0,0 +1,141 @@
+#ifndef _MVEE_AGENT_STATS_H
+#define _MVEE_AGENT_STATS_H
+
+#include <hp-timing.h>
+
+//
+// Per-thread agent statistics (glibc.mvee.stats).
+//
+// Every thread that goes through one of the agents gets its own statistics
+// page, which it registers with the MVEE through MVEE_REGISTER_STATS_PAGE the
+// first time it counts something. The thread unregisters the page (by
+// registering NULL, 0) and unmaps it when it exits. Only the owning thread
+// writes to the page, so the counters are plain increments. The monitor can
+// read them at any time but might see them slightly out of date.
+//
+// Waits are timed in hp-timing units (TSC ticks on x86), from the first time a
+// thread backs off until it can proceed. Waits that don't back off aren't
+// timed, so they cost nothing extra. The total/partial agent is the exception:
+// it times every slave wait.
+//
+// Keep the layout in sync with the MVEE. Bump the version if you change it.
+//
+// Include after mvee-agent-shared.h and <atomic.h>.
+//
+#define MVEE_STATS_VERSION       1
+#define MVEE_STATS_PAGE_SIZE     4096
+#define MVEE_STATS_WAIT_BUCKETS  32
+
+struct mvee_thread_stats
+{
+  unsigned int  version;          // MVEE_STATS_VERSION
+  unsigned int  size;             // sizeof(struct mvee_thread_stats)
+  // nr of preops per enum mvee_base_atomics type. The last counter holds the
+  // preops for atomics in instrumented programs (enum mvee_extended_atomics).
+  unsigned long preops[__MVEE_BASE_ATOMICS_MAX__ + 1];
+  unsigned long shm_ops;          // nr of operations the SHM agent logged or checked
+  unsigned long spins;            // nr of times we relaxed the cpu while waiting
+  unsigned long yields;           // nr of times we yielded while waiting
+  unsigned long futex_waits;      // nr of times we went to sleep while waiting
+  unsigned long flushes;          // nr of buffer flushes through the MVEE
+  unsigned long waits;            // nr of timed waits
+  unsigned long wait_time;        // total duration of those waits
+  // waits by duration. Bucket i counts waits of [2^i, 2^(i+1)[ units, the last
+  // bucket counts everything longer.
+  unsigned long wait_hist[MVEE_STATS_WAIT_BUCKETS];
+  hp_timing_t   wait_start;       // start of the wait in progress. Not a statistic.
+} __attribute__((aligned(64)));
+
+_Static_assert (sizeof (struct mvee_thread_stats) <= MVEE_STATS_PAGE_SIZE,
+                "struct mvee_thread_stats doesn't fit in its page");
+
+extern unsigned char                           mvee_stats_enabled;
+extern __thread struct mvee_thread_stats*      mvee_thread_stats attribute_hidden;
+extern struct mvee_thread_stats* mvee_stats_attach(void) attribute_hidden;
+
+// Returns the calling thread's statistics, or NULL if we don't collect any
+static inline struct mvee_thread_stats* mvee_stats(void)
+{
+  if (likely(!mvee_stats_enabled))
+    return NULL;
+  if (unlikely(mvee_thread_stats == NULL))
+    return mvee_stats_attach();
+  return mvee_thread_stats;
+}
+
+static inline void mvee_stats_count_preop(unsigned short op_type)
+{
+  struct mvee_thread_stats* stats = mvee_stats();
+  if (unlikely(stats != NULL))
+    stats->preops[op_type < __MVEE_BASE_ATOMICS_MAX__ ? op_type : __MVEE_BASE_ATOMICS_MAX__]++;
+}
+
+#define MVEE_STATS_COUNTER(name)                        \
+static inline void mvee_stats_count_##name(void)        \
+{                                                       \
+  struct mvee_thread_stats* stats = mvee_stats();       \
+  if (unlikely(stats != NULL))                          \
+    stats->name++;                                      \
+}
+
+MVEE_STATS_COUNTER(shm_ops)
+MVEE_STATS_COUNTER(flushes)
+
+enum mvee_stats_backoffs
+{
+  MVEE_STATS_SPIN  = 0,
+  MVEE_STATS_YIELD = 1,
+  MVEE_STATS_SLEEP = 2  // futex wait
+};
+
+//
+// Call once per iteration of a wait loop, right before backing off. @waited
+// is the nr of times we've backed off already in this wait. The first backoff
+// starts timing the wait.
+//
+static inline void mvee_stats_count_backoff(unsigned int waited, unsigned char backoff)
+{
+  struct mvee_thread_stats* stats = mvee_stats();
+  if (likely(stats == NULL))
+    return;
+  if (!waited)
+    HP_TIMING_NOW(stats->wait_start);
+  if (backoff == MVEE_STATS_SPIN)
+    stats->spins++;
+  else if (backoff == MVEE_STATS_YIELD)
+    stats->yields++;
+  else
+    stats->futex_waits++;
+}
+
+// Starts timing a wait that doesn't go through mvee_stats_count_backoff
+static inline void mvee_stats_wait_begin(void)
+{
+  struct mvee_thread_stats* stats = mvee_stats();
+  if (unlikely(stats != NULL))
+    HP_TIMING_NOW(stats->wait_start);
+}
+
+// Ends the wait that was started by mvee_stats_count_backoff or
+// mvee_stats_wait_begin. A wait in which we never backed off (@waited == 0)
+// isn't recorded.
+static inline void mvee_stats_wait_end(unsigned int waited)
+{
+  struct mvee_thread_stats* stats = mvee_stats();
+  if (likely(stats == NULL) || !waited)
+    return;
+
+  hp_timing_t now, diff;
+  HP_TIMING_NOW(now);
+  HP_TIMING_DIFF(diff, stats->wait_start, now);
+
+  unsigned int bucket = diff ? 63 - __builtin_clzll(diff) : 0;
+  if (bucket >= MVEE_STATS_WAIT_BUCKETS)
+    bucket = MVEE_STATS_WAIT_BUCKETS - 1;
+
+  stats->waits++;
+  stats->wait_time += diff;
+  stats->wait_hist[bucket]++;
+}
+
+#endif /* _MVEE_AGENT_STATS_H */
@@ -0,0 +1,53 @@
+/* Find the first byte in which two buffers differ.  Generic version.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+#include <stddef.h>
+#include <string.h>
+
+#ifndef MVEE_FIND_MISMATCH
+# define MVEE_FIND_MISMATCH __mvee_find_mismatch
+extern size_t MVEE_FIND_MISMATCH (const void *a, const void *b, size_t size)
+  attribute_hidden;
+#endif
+
+/* Return the offset of the first byte in which A and B differ, or SIZE if
+   the first SIZE bytes of both are the same.  The SHM agent uses this to
+   find the words a follower's store differs from the leader's in.  */
+size_t
+MVEE_FIND_MISMATCH (const void *a, const void *b, size_t size)
+{
+  const unsigned char *pa = a;
+  const unsigned char *pb = b;
+  size_t offset = 0;
+
+  for (; offset + sizeof (unsigned long) <= size;
+       offset += sizeof (unsigned long))
+    {
+      unsigned long wa, wb;
+      memcpy (&wa, pa + offset, sizeof (wa));
+      memcpy (&wb, pb + offset, sizeof (wb));
+      if (wa != wb)
+	break;
+    }
+
+  for (; offset < size; offset++)
+    if (pa[offset] != pb[offset])
+      return offset;
+
+  return size;
+}
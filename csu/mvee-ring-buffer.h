@@ -0,0 +1,54 @@
+#ifndef _MVEE_RING_BUFFER_H
+#define _MVEE_RING_BUFFER_H
+
+//
+// Ring buffer mode for the replication queues (glibc.mvee.ring_buffers).
+//
+// A full queue is normally flushed through the MVEE, which stalls all
+// variants. In ring buffer mode, the leader wraps around instead. Positions are
+// monotonically increasing sequence numbers, and every follower publishes how
+// far it got in a header at the start of the buffer, one cache line per variant.
+// The leader only reads the header when it is about to overwrite entries that
+// the slowest follower it knows of hasn't consumed yet.
+//
+// Include after <atomic.h>.
+//
+
+#define MVEE_RING_HEADER_SIZE   ((unsigned long) mvee_num_variants * 64)
+
+static inline volatile unsigned long* mvee_ring_consumed(void* ring, unsigned short variant)
+{
+  return (volatile unsigned long*)((char*)ring + variant * 64);
+}
+
+// Follower: we're done with everything before sequence number @seq
+static inline void mvee_ring_consume(void* ring, unsigned long seq)
+{
+  orig_atomic_store_release(mvee_ring_consumed(ring, mvee_my_variant_num), seq);
+}
+
+// Leader: wait until we can fill the buffer up to (but not including) sequence
+// number @end. @min_consumed caches the position of the slowest follower.
+static inline void mvee_ring_wait_for_space(void* ring, unsigned long end, unsigned long capacity, unsigned long* min_consumed)
+{
+  while (unlikely(end - *min_consumed > capacity))
+  {
+    unsigned long min = end;
+
+    for (unsigned short i = 0; i < mvee_num_variants; ++i)
+    {
+      if (i == mvee_my_variant_num)
+        continue;
+
+      unsigned long consumed = orig_atomic_load_acquire(mvee_ring_consumed(ring, i));
+      if (consumed < min)
+        min = consumed;
+    }
+
+    *min_consumed = min;
+    if (end - min > capacity)
+      syscall(__NR_sched_yield);
+  }
+}
+
+#endif /* _MVEE_RING_BUFFER_H */
@@ -16,6 +16,10 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "mvee-agent-stats.h"
+#include "mvee-ring-buffer.h"
+#include "mvee-thread-control.h"
+
 // ========================================================================================================================
 // Forward declarations for the original (ifunc) implementations of mem* functions
 // ========================================================================================================================
@@ -26,6 +30,15 @@ extern __typeof (memchr)  orig_memchr;
 extern __typeof (memcmp)  orig_memcmp;
 extern __typeof (strlen)  orig_strlen;
 extern __typeof (strcmp)  orig_strcmp;
+extern __typeof (strncmp) orig_strncmp;
+extern __typeof (strnlen) orig_strnlen;
+extern __typeof (strchr)  orig_strchr;
+extern __typeof (strrchr) orig_strrchr;
+extern __typeof (rawmemchr) orig_rawmemchr;
+extern __typeof (memrchr) orig_memrchr;
+
+// Returns the offset of the first byte in which @a and @b differ, or @size
+extern size_t __mvee_find_mismatch (const void* a, const void* b, size_t size) attribute_hidden;
 
 // ========================================================================================================================
 // Types of SHM operations
@@ -61,6 +74,12 @@ enum
   MEMCMP          = GLIBC_FUNC_BASE + 4,
   STRLEN          = GLIBC_FUNC_BASE + 5,
   STRCMP          = GLIBC_FUNC_BASE + 6,
+  STRNCMP         = GLIBC_FUNC_BASE + 7,
+  STRNLEN         = GLIBC_FUNC_BASE + 8,
+  STRCHR          = GLIBC_FUNC_BASE + 9,
+  STRRCHR         = GLIBC_FUNC_BASE + 10,
+  RAWMEMCHR       = GLIBC_FUNC_BASE + 11,
+  MEMRCHR         = GLIBC_FUNC_BASE + 12,
 };
 
 #define LOAD_BY_SIZE(out_address, in_address, size)                                                                \
@@ -230,39 +249,45 @@ static inline void mvee_assert_same_size(size_t a, size_t b)
 
 static void mvee_assert_same_store(const void* a, const void* b, const unsigned long size, bool might_contain_pointers)
 {
-  /* Check if the buffers are the same. If they are, no issue! */
-  if (!orig_memcmp(a, b, size))
+  /* Find the first difference. __mvee_find_mismatch is an IFUNC that uses AVX2 where available. If there is
+   * none, no issue! */
+  size_t offset = __mvee_find_mismatch(a, b, size);
+  if (likely(offset == size))
     return;
 
-  /* Check if the buffers are equivalent. We implemented this check based on three assumptions:
+  /* Check if the buffers are equivalent. We implemented this check based on two assumptions:
    * 1. The only type of data that can differ yet still be equivalent is pointers.
    * 2. Pointers can only be stored in an aligned manner (this is not correct!).
-   * 3. Pointers are stored using single stores, not memcpy. The overhead of comparing the
-   * complete buffers first, and doing an element-wise comparison of the entire buffer after
-   * is thus negligible.
+   * We therefore only decode the words that actually differ, and skip ahead to the next difference after each
+   * one, rather than comparing the entire buffer word by word.
    */
-  if (might_contain_pointers)
+  if (!might_contain_pointers)
   {
-    /* If there is **any** difference in the entire buffer. Start looking for the difference, byte per byte */
-    size_t offset;
-    for (offset = 0; (offset + sizeof(void*)) <= size; offset += sizeof(void*))
-    {
-      /* Read the data that constitutes the potential pointers */
-      void* pa = *((void**)(a + offset));
-      void* pb = *((void**)(b + offset));
+    syscall(__NR_gettid, 1337, 10000001, 103, a, b, size);
+    return;
+  }
 
-      /* No difference, move on */
-      if (pa == pb)
-        continue;
+  while (offset < size)
+  {
+    offset &= ~(sizeof(void*) - 1);
+
+    /* The difference is in the trailing bytes, which can't hold a pointer. Inform the monitor. */
+    if (offset + sizeof(void*) > size)
+    {
+      syscall(__NR_gettid, 1337, 10000001, 103, a, b, size);
+      return;
+    }
 
-      /* If the decoded pointers differ, they're actually differing data. Inform the monitor. */
-      if (!mvee_are_pointers_equivalent(pa, pb))
-        syscall(__NR_gettid, 1337, 10000001, 103, a, b, size);
+    /* If the decoded pointers differ, they're actually differing data. Inform the monitor. */
+    if (!mvee_are_pointers_equivalent(*((void**)(a + offset)), *((void**)(b + offset))))
+    {
+      syscall(__NR_gettid, 1337, 10000001, 103, a, b, size);
+      return;
     }
+
+    offset += sizeof(void*);
+    offset += __mvee_find_mismatch(a + offset, b + offset, size - offset);
   }
-  /* The buffers **have** to be the same, so this is a divergence. Inform the monitor. */
-  else
-    syscall(__NR_gettid, 1337, 10000001, 103, a, b, size);
 }
 
 static inline void mvee_assert_same_type(unsigned char a, unsigned char b)
@@ -306,6 +331,12 @@ static void mvee_error_shm_entry_not_present(const void *addr)
   *(volatile long*)0 = (volatile long) addr;
 }
 
+__attribute__((noinline))
+static void mvee_error_shm_table_alloc_failed(size_t size)
+{
+  *(volatile long*)0 = (long) size;
+}
+
 // ========================================================================================================================
 // Everything table-related
 // ========================================================================================================================
@@ -313,87 +344,270 @@ typedef struct mvee_shm_table_entry {
   void* address;
   void* shadow;
   size_t len;
-  struct mvee_shm_table_entry* prev;
-  struct mvee_shm_table_entry* next;
 } mvee_shm_table_entry;
 
-static mvee_shm_table_entry* mvee_shm_table_head = NULL;
+/* Readers never lock the table. Every update builds a new table, sorted by
+ * address, and publishes it with a store-release. Lookups binary search the
+ * current table.
+ *
+ * Old tables are reclaimed once every thread that has ever done a lookup has
+ * passed a quiescent point since the table was replaced. Threads don't hold on
+ * to entries across syscalls (mvee_shm_syscall_boundary) or beyond their exit,
+ * so those are our quiescent points. Every reader has a slot in which it
+ * publishes the table version it saw at its last quiescent point, and a table
+ * can go once all slots are past its version. Updates only happen in
+ * (sh)mmap/(sh)munmap calls, which are far slower than a lookup, so we only
+ * look for tables to reclaim then.
+ *
+ * A thread that doesn't get a slot disables reclamation. Threads that stop
+ * making syscalls delay it.
+ */
+#define MVEE_SHM_TABLE_READERS 1024
+
+typedef struct mvee_shm_table {
+  unsigned long version;
+  size_t size;
+  size_t count;
+  struct mvee_shm_table* next_retired;
+  mvee_shm_table_entry entries[];
+} mvee_shm_table;
+
+// One cache line per reader. 0 means the slot is free
+typedef struct mvee_shm_table_reader {
+  unsigned long version;
+  char padding[64 - sizeof(unsigned long)];
+} mvee_shm_table_reader;
+
+static mvee_shm_table* mvee_shm_table_current = NULL;
+static mvee_shm_table* mvee_shm_table_retired = NULL;
+static unsigned long mvee_shm_table_version = 0;
+static mvee_shm_table_reader* mvee_shm_table_readers = NULL;
+static unsigned int mvee_shm_table_readers_used = 0; // high water mark
+static unsigned char mvee_shm_table_readers_full = 0;
+
+/* 1 + our slot in mvee_shm_table_readers, 0 if we haven't got one yet */
+static __thread unsigned int mvee_shm_table_reader_slot = 0;
+
+/* Per-thread last hit. Only valid while the table version doesn't change */
+static __thread mvee_shm_table_entry* mvee_shm_table_cached_entry = NULL;
+static __thread unsigned long mvee_shm_table_cached_version = 0;
 
 __libc_lock_define_initialized (static, mvee_shm_table_lock)
 
-void mvee_shm_table_add_entry(void* address, void* shadow, size_t len)
+/* Must be called with mvee_shm_table_lock held */
+static void mvee_shm_table_alloc_readers(void)
 {
-  __libc_lock_lock(mvee_shm_table_lock);
+  size_t size = MVEE_SHM_TABLE_READERS * sizeof(mvee_shm_table_reader);
+  mvee_shm_table_reader* readers = (mvee_shm_table_reader*) orig_MMAP_CALL(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (readers == MAP_FAILED)
+    mvee_error_shm_table_alloc_failed(size);
 
-  /* Prepare entry */
-  mvee_shm_table_entry *entry = (mvee_shm_table_entry *) malloc(sizeof(mvee_shm_table_entry));
-  entry->address = address;
-  entry->shadow = shadow;
-  entry->len = len;
-  entry->prev = NULL;
-  entry->next = NULL;
-
-  /* Insert entry, or make it the new head if none exists yet */
-  mvee_shm_table_entry *iterator = mvee_shm_table_head;
-  if (iterator)
+  /* The first table is published after this, with a store-release */
+  mvee_shm_table_readers = readers;
+
+  /* From now on, syscalls are quiescent points */
+  mvee_shm_syscall_hook = 1;
+}
+
+/* Must be called with mvee_shm_table_lock held */
+static mvee_shm_table* mvee_shm_table_alloc(size_t count)
+{
+  size_t size = sizeof(mvee_shm_table) + count * sizeof(mvee_shm_table_entry);
+  size = (size + 4095) & ~4095ul;
+
+  mvee_shm_table* table = (mvee_shm_table*) orig_MMAP_CALL(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (table == MAP_FAILED)
+    mvee_error_shm_table_alloc_failed(size);
+
+  if (unlikely(!mvee_shm_table_readers))
+    mvee_shm_table_alloc_readers();
+
+  table->version = mvee_shm_table_version + 1;
+  table->size = size;
+  table->count = 0;
+  table->next_retired = NULL;
+  return table;
+}
+
+/* Must be called with mvee_shm_table_lock held. Returns the oldest version a
+ * reader might still be using, or 0 if we can't tell.
+ */
+static unsigned long mvee_shm_table_oldest_reader(void)
+{
+  unsigned long oldest = ~0ul;
+
+  if (mvee_shm_table_readers_full)
+    return 0;
+
+  for (unsigned int i = 0; i < orig_atomic_load_acquire(&mvee_shm_table_readers_used); i++)
   {
-    /* Insert in a sorted order, so make our entry the new head if necessary */
-    if ((address + len) <= iterator->address)
+    unsigned long version = orig_atomic_load_acquire(&mvee_shm_table_readers[i].version);
+    if (version && version < oldest)
+      oldest = version;
+  }
+
+  return oldest;
+}
+
+/* Must be called with mvee_shm_table_lock held */
+static void mvee_shm_table_publish(mvee_shm_table* table)
+{
+  mvee_shm_table* old = mvee_shm_table_current;
+
+  orig_atomic_store_release(&mvee_shm_table_current, table);
+  orig_atomic_store_release(&mvee_shm_table_version, table->version);
+
+  if (old)
+  {
+    old->next_retired = mvee_shm_table_retired;
+    mvee_shm_table_retired = old;
+  }
+
+  /* Pairs with the barrier in mvee_shm_table_register_reader. Either the
+   * reader's slot is visible here, or the reader sees the new table.
+   */
+  atomic_full_barrier();
+
+  /* A table is unused once every reader has seen a newer version at a
+   * quiescent point. A version stays current until the next publish, so a
+   * reader that saw a table's version might still be using it.
+   */
+  unsigned long oldest = mvee_shm_table_oldest_reader();
+  mvee_shm_table** prev = &mvee_shm_table_retired;
+  while (*prev)
+  {
+    mvee_shm_table* retired = *prev;
+    if (retired->version < oldest)
     {
-      entry->next = iterator;
-      iterator->prev = entry;
-      orig_atomic_store_release(&mvee_shm_table_head, entry);
+      *prev = retired->next_retired;
+      orig_MUNMAP_CALL(retired, retired->size);
     }
     else
-    {
-      /* Insert half-way? */
-      while (iterator->next)
-      {
-        if (((iterator->address + iterator->len) <= address) && ((address + len) <= iterator->next->address))
-        {
-          entry->next = iterator->next;
-          entry->prev = iterator;
-          iterator->next->prev = entry;
-          orig_atomic_store_release(&iterator->next, entry);
-          break;
-        }
-        iterator = iterator->next;
-      }
+      prev = &retired->next_retired;
+  }
+}
 
-      /* Insert at the end */
-      if (!iterator->next)
-      {
-        /* Do sanity check, should not be possible. */
-        if (address < (iterator->address + iterator->len))
-          mvee_error_shm_entry_not_present(address);
+/* Takes a reader slot for the calling thread, before its first lookup */
+static void mvee_shm_table_register_reader(void)
+{
+  unsigned long version = orig_atomic_load_acquire(&mvee_shm_table_version);
 
-        entry->prev = iterator;
-        orig_atomic_store_release(&iterator->next, entry);
-      }
+  for (unsigned int i = 0; i < MVEE_SHM_TABLE_READERS; i++)
+  {
+    if (!orig_atomic_compare_and_exchange_bool_acq(&mvee_shm_table_readers[i].version, version, 0))
+    {
+      mvee_shm_table_reader_slot = i + 1;
+      orig_atomic_max(&mvee_shm_table_readers_used, i + 1);
+      break;
     }
   }
-  else
-    orig_atomic_store_release(&mvee_shm_table_head, entry);
+
+  if (unlikely(!mvee_shm_table_reader_slot))
+    orig_atomic_store_release(&mvee_shm_table_readers_full, 1);
+
+  /* Our slot must be visible before we load the table */
+  atomic_full_barrier();
+}
+
+/* Quiescent point: we don't hold on to any table entries right now */
+static inline void mvee_shm_table_quiescent(void)
+{
+  if (mvee_shm_table_reader_slot)
+    orig_atomic_store_release(&mvee_shm_table_readers[mvee_shm_table_reader_slot - 1].version,
+        orig_atomic_load_acquire(&mvee_shm_table_version));
+}
+
+/* The calling thread exits, or stops using SHM */
+static void mvee_shm_table_unregister_reader(void)
+{
+  if (mvee_shm_table_reader_slot)
+  {
+    orig_atomic_store_release(&mvee_shm_table_readers[mvee_shm_table_reader_slot - 1].version, 0);
+    mvee_shm_table_reader_slot = 0;
+  }
+}
+
+void mvee_shm_table_add_entry(void* address, void* shadow, size_t len)
+{
+  __libc_lock_lock(mvee_shm_table_lock);
+
+  mvee_shm_table* old = mvee_shm_table_current;
+  size_t old_count = old ? old->count : 0;
+  mvee_shm_table* table = mvee_shm_table_alloc(old_count + 1);
+
+  /* Copy the entries below the new one, then the new one, then the rest */
+  size_t i = 0;
+  while (i < old_count && old->entries[i].address < address)
+  {
+    table->entries[i] = old->entries[i];
+    i++;
+  }
+
+  /* Do sanity check, should not be possible. */
+  if ((i > 0 && address < (old->entries[i - 1].address + old->entries[i - 1].len)) ||
+      (i < old_count && (address + len) > old->entries[i].address))
+    mvee_error_shm_entry_not_present(address);
+
+  table->entries[i].address = address;
+  table->entries[i].shadow = shadow;
+  table->entries[i].len = len;
+  if (i < old_count)
+    orig_memcpy(&table->entries[i + 1], &old->entries[i], (old_count - i) * sizeof(mvee_shm_table_entry));
+  table->count = old_count + 1;
+
+  mvee_shm_table_publish(table);
 
   __libc_lock_unlock(mvee_shm_table_lock);
 }
 
-/* There's no need for locks in this function, the store-release semantics used
- * by the functions updating this table means a load-acquire should be enough
- * here.
+/* Lock-free. The store-release when publishing a table means a load-acquire is
+ * enough here.
  */
 static mvee_shm_table_entry* mvee_shm_table_get_entry(const void* address)
 {
-  mvee_shm_table_entry* entry = orig_atomic_load_acquire(&mvee_shm_table_head);
-  while (entry)
+  unsigned long version = orig_atomic_load_acquire(&mvee_shm_table_version);
+  mvee_shm_table_entry* entry = mvee_shm_table_cached_entry;
+
+  if (likely(entry != NULL && version == mvee_shm_table_cached_version &&
+      (uintptr_t)entry->address <= (uintptr_t)address &&
+      (uintptr_t)address < (uintptr_t)entry->address + entry->len))
+    return entry;
+
+  mvee_shm_table* table = orig_atomic_load_acquire(&mvee_shm_table_current);
+  if (!table)
+    return NULL;
+
+  if (unlikely(!mvee_shm_table_reader_slot))
   {
-    /* If we found the entry, quit */
-    if (((uintptr_t)entry->address <= (uintptr_t)address) && ((uintptr_t)address < ((uintptr_t)entry->address + entry->len)))
-      break;
+    /* The table we just loaded might have been replaced and unmapped
+     * before our slot was visible. Load it again.
+     */
+    mvee_shm_table_register_reader();
+    table = orig_atomic_load_acquire(&mvee_shm_table_current);
+  }
 
-    entry = orig_atomic_load_acquire(&entry->next);
+  /* Find the last entry that starts at or below address */
+  size_t lo = 0, hi = table->count;
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if ((uintptr_t)table->entries[mid].address <= (uintptr_t)address)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
+  if (lo == 0)
+    return NULL;
+
+  entry = &table->entries[lo - 1];
+  if ((uintptr_t)address >= (uintptr_t)entry->address + entry->len)
+    return NULL;
+
+  mvee_shm_table_cached_entry = entry;
+  mvee_shm_table_cached_version = table->version;
   return entry;
 }
 
@@ -403,18 +617,14 @@ static bool mvee_shm_table_delete_entry(mvee_shm_table_entry* remove)
   {
     __libc_lock_lock(mvee_shm_table_lock);
 
-    /* Unlink */
-    mvee_shm_table_entry* next = remove->next;
-    mvee_shm_table_entry* prev = remove->prev;
-    if (next)
-      next->prev = prev;
-    if (prev)
-      orig_atomic_store_release(&prev->next, next);
-    else if (remove == mvee_shm_table_head)/* Special case for head */
-      orig_atomic_store_release(&mvee_shm_table_head, next);
+    /* remove might point into an older table, so match on the address */
+    mvee_shm_table* old = mvee_shm_table_current;
+    mvee_shm_table* table = mvee_shm_table_alloc(old->count);
+    for (size_t i = 0; i < old->count; i++)
+      if (old->entries[i].address != remove->address)
+        table->entries[table->count++] = old->entries[i];
 
-    /* Free memory */
-    free(remove);
+    mvee_shm_table_publish(table);
 
     __libc_lock_unlock(mvee_shm_table_lock);
     return true;
@@ -435,6 +645,12 @@ typedef struct mvee_shm_op_entry {
   size_t size;
   uint64_t value;
   uint64_t cmp;
+  // set by the leader once the entry is filled in: 1 + the sequence number of
+  // the entry's first byte. Entries vary in size and the tail we skip at a
+  // wrap varies too, so in ring buffer mode, an entry can start on an older
+  // header or in the middle of an older entry's data. An older header holds
+  // a smaller sequence number, unlike a lap bit that repeats every two laps.
+  unsigned long seq;
   unsigned short nr_of_variants_checked;
   unsigned char type;
   unsigned char replication_type;// 0 is no replication, 1 is replication from shadow memory, 2 is replication from buffer
@@ -446,34 +662,277 @@ typedef struct mvee_shm_op_ret {
   bool cmp;
 } mvee_shm_op_ret;
 
+// The buffer itself is mvee_thread_state.shm_buffer, so that it is cleared in forked children
 static __thread size_t                mvee_shm_local_pos    = 0; // our position in the thread local queue
-static __thread char*                 mvee_shm_buffer       = NULL;
 static __thread size_t                mvee_shm_buffer_size  = 0; // nr of slots in the thread local queue
+static __thread unsigned long         mvee_shm_local_seq    = 0; // nr of bytes we've written or consumed
+static __thread unsigned long         mvee_shm_entry_seq    = 0; // the seq value of the entry we're writing/reading
+// ring buffer mode only
+static __thread void*                 mvee_shm_ring         = NULL; // the header in front of the buffer
+static __thread unsigned long         mvee_shm_min_consumed = 0; // leader only
+
+// ========================================================================================================================
+// Write combining
+// ========================================================================================================================
+
+// With glibc.mvee.shm_write_combining=1, we hold back plain STOREs that
+// continue the previous one in the same mapping, and do them all at once as a
+// single MEMCPY operation. Followers then check the combined write. We flush
+// before any other SHM operation, before any libc synchronization operation,
+// when the batch is full, and at the syscalls and exits listed for the check
+// window below. Both variants see the same sequence of operations, so they
+// combine the same stores.
+//
+// We remember the mapping by its address rather than by its table entry. The
+// table might be replaced while we hold the stores back.
+//
+// Batches start at word-aligned addresses only, so pointers stored in the
+// batch are word-aligned in the data, which mvee_assert_same_store expects.
+#define MVEE_SHM_WC_MAX 256
+
+static __thread char                  mvee_shm_wc_data[MVEE_SHM_WC_MAX];
+static __thread size_t                mvee_shm_wc_size      = 0; // nr of bytes held back
+static __thread void*                 mvee_shm_wc_start     = NULL;
+static __thread void*                 mvee_shm_wc_mapping   = NULL; // the address of the mapping
+
+static void mvee_shm_flush_stores(void);
+
+// ========================================================================================================================
+// Deferred checking
+// ========================================================================================================================
+
+// By default, the leader waits for all followers to check an operation before
+// it writes to SHM. With glibc.mvee.shm_check_window=N, the leader does plain
+// stores, copies and memsets right away and keeps up to N of them unchecked.
+// It waits for the followers when the window is full, before it does an SHM
+// atomic, and before any libc synchronization operation. Other processes can
+// therefore only observe unchecked writes through data races.
+// The MVEE doesn't hold the leader back at syscalls that IP-MON handles, so we
+// also drain the window before syscalls that can pass data on to other
+// processes, at thread exit and at _exit (mvee_shm_syscall_boundary).
+//
+// Followers check entries in order. Once they've checked an entry, they've
+// checked all older entries too.
+#define MVEE_SHM_MAX_CHECK_WINDOW 64
+
+static __thread mvee_shm_op_entry*    mvee_shm_unchecked[MVEE_SHM_MAX_CHECK_WINDOW];
+static __thread unsigned int          mvee_shm_unchecked_first = 0;
+static __thread unsigned int          mvee_shm_unchecked_count = 0;
+
+// Leader: waits until all followers have checked the entry
+static inline void mvee_shm_wait_for_checks(mvee_shm_op_entry* entry)
+{
+  unsigned int waited = 0;
+
+  while (orig_atomic_load_acquire(&entry->nr_of_variants_checked) != mvee_num_variants)
+  {
+    mvee_stats_count_backoff(waited++, MVEE_STATS_SPIN);
+    arch_cpu_relax();
+  }
+
+  mvee_stats_wait_end(waited);
+}
+
+// Leader: waits until all followers have checked all entries
+static void mvee_shm_drain_checks(void)
+{
+  if (mvee_shm_unchecked_count)
+  {
+    unsigned int last = (mvee_shm_unchecked_first + mvee_shm_unchecked_count - 1) % MVEE_SHM_MAX_CHECK_WINDOW;
+    mvee_shm_wait_for_checks(mvee_shm_unchecked[last]);
+    mvee_shm_unchecked_count = 0;
+  }
+}
+
+// Leader: adds the entry to the window, waits for the oldest entry if it's full
+static inline void mvee_shm_defer_checks(mvee_shm_op_entry* entry)
+{
+  if (mvee_shm_unchecked_count >= mvee_shm_check_window || mvee_shm_unchecked_count >= MVEE_SHM_MAX_CHECK_WINDOW)
+  {
+    mvee_shm_wait_for_checks(mvee_shm_unchecked[mvee_shm_unchecked_first]);
+    mvee_shm_unchecked_first = (mvee_shm_unchecked_first + 1) % MVEE_SHM_MAX_CHECK_WINDOW;
+    mvee_shm_unchecked_count--;
+  }
+
+  mvee_shm_unchecked[(mvee_shm_unchecked_first + mvee_shm_unchecked_count) % MVEE_SHM_MAX_CHECK_WINDOW] = entry;
+  mvee_shm_unchecked_count++;
+}
 
 static mvee_shm_op_entry* mvee_shm_get_entry(size_t size)
 {
+  // Plain stores we've held back must be done before any other operation
+  if (unlikely(mvee_shm_wc_size != 0))
+    mvee_shm_flush_stores();
+
+  mvee_stats_count_shm_ops();
+
   // Get the buffer if we don't have it yet
-  if (unlikely(!mvee_shm_buffer))
+  if (unlikely(!mvee_thread_state.shm_buffer))
   {
-    mvee_shm_buffer = (char*)syscall(__NR_shmat, syscall(MVEE_GET_SHARED_BUFFER, 0, MVEE_SHM_BUFFER, &mvee_shm_buffer_size, 1, 0), NULL, 0);
-    syscall(MVEE_RESET_ATFORK, &mvee_shm_buffer, sizeof(mvee_shm_buffer));
-    mvee_shm_local_pos = 0;
+    struct mvee_thread_control* control = mvee_get_thread_control();
+    long id;
+    if (likely(control && control->buffers[MVEE_THREAD_SHM_BUFFER].id >= 0))
+    {
+      id                   = control->buffers[MVEE_THREAD_SHM_BUFFER].id;
+      mvee_shm_buffer_size = control->buffers[MVEE_THREAD_SHM_BUFFER].size;
+    }
+    else
+    {
+      id = syscall(MVEE_GET_SHARED_BUFFER, 0, MVEE_SHM_BUFFER, &mvee_shm_buffer_size, 1, 0);
+      syscall(MVEE_RESET_ATFORK, &mvee_thread_state.shm_buffer, sizeof(mvee_thread_state.shm_buffer));
+    }
+
+    char* buffer = (char*)syscall(__NR_shmat, id, NULL, 0);
+    if (mvee_ring_buffers)
+    {
+      mvee_shm_ring         = buffer;
+      buffer               += MVEE_RING_HEADER_SIZE;
+      mvee_shm_buffer_size -= MVEE_RING_HEADER_SIZE;
+    }
+    mvee_thread_state.shm_buffer = buffer;
+    mvee_shm_local_pos    = 0;
+    mvee_shm_local_seq    = 0;
+    mvee_shm_min_consumed = 0;
   }
 
   // Find location for entry in buffer
   size_t entry_size = MVEE_ROUND_UP(sizeof(mvee_shm_op_entry) + size, 64);
   if (unlikely(mvee_shm_local_pos + entry_size >= mvee_shm_buffer_size))
   {
-    syscall(MVEE_FLUSH_SHARED_BUFFER, MVEE_SHM_BUFFER);
+    // We're about to reuse entries, which resets their check counts
+    mvee_shm_drain_checks();
+
+    if (mvee_shm_ring)
+    {
+      // Entries never wrap. Skip the tail of the buffer and start a new lap.
+      mvee_shm_local_seq += mvee_shm_buffer_size - mvee_shm_local_pos;
+    }
+    else
+    {
+      mvee_stats_count_flushes();
+      syscall(MVEE_FLUSH_SHARED_BUFFER, MVEE_SHM_BUFFER);
+    }
     mvee_shm_local_pos = 0;
   }
 
+  // Don't overwrite entries the followers still need
+  if (unlikely(mvee_shm_ring != NULL) && likely(mvee_master_variant))
+    mvee_ring_wait_for_space(mvee_shm_ring, mvee_shm_local_seq + entry_size, mvee_shm_buffer_size, &mvee_shm_min_consumed);
+
   // Calculate entry, update pos, and return
-  mvee_shm_op_entry* entry = (mvee_shm_op_entry*) (mvee_shm_buffer + mvee_shm_local_pos);
+  mvee_shm_op_entry* entry = (mvee_shm_op_entry*) (mvee_thread_state.shm_buffer + mvee_shm_local_pos);
+  mvee_shm_entry_seq  = mvee_shm_local_seq + 1;
   mvee_shm_local_pos += entry_size;
+  mvee_shm_local_seq += entry_size;
   return entry;
 }
 
+// Leader: makes the entry visible to the followers. This must be the last write
+// to the entry before the followers can start checking it.
+static inline void mvee_shm_publish_entry(mvee_shm_op_entry* entry)
+{
+  orig_atomic_store_release(&entry->seq, mvee_shm_entry_seq);
+}
+
+// Follower: waits until the leader has published the entry
+static inline void mvee_shm_wait_for_entry(mvee_shm_op_entry* entry)
+{
+  unsigned int waited = 0;
+
+  while (orig_atomic_load_acquire(&entry->seq) != mvee_shm_entry_seq)
+  {
+    mvee_stats_count_backoff(waited++, MVEE_STATS_SPIN);
+    arch_cpu_relax();
+  }
+
+  mvee_stats_wait_end(waited);
+}
+
+// Follower: we won't look at the entry we got last anymore
+static inline void mvee_shm_consume_entry(void)
+{
+  if (unlikely(mvee_shm_ring != NULL))
+    mvee_ring_consume(mvee_shm_ring, mvee_shm_local_seq);
+}
+
+// ========================================================================================================================
+// Block-granular replication of large SHM reads
+// ========================================================================================================================
+
+// When the leader copies a large range out of a SHM mapping with a shadow, it
+// compares the range to its shadow block per block and only logs the blocks
+// that differ. The entry then holds a bitmap of the changed blocks, followed by
+// the contents of those blocks. All variants assemble the copy from their own
+// shadow and the logged blocks. If more than fits in the entry has changed, we
+// log the whole range instead, like we do for small copies.
+//
+// All variants then write the logged blocks into their shadow of the source,
+// so a block that another process changed is only logged once, not on every
+// later copy. The copy itself already gave every variant the leader's view of
+// those blocks, so any variant-specific data they held in the shadow is stale.
+#define MVEE_SHM_BLOCK_SIZE     256
+#define MVEE_SHM_BLOCK_MIN_COPY 4096
+
+static inline size_t mvee_shm_block_bitmap_size(size_t size)
+{
+  return ((size + MVEE_SHM_BLOCK_SIZE - 1) / MVEE_SHM_BLOCK_SIZE + 7) / 8;
+}
+
+// Leader: logs the blocks of [shm, shm + size[ that differ from the shadow in
+// buf, which holds size bytes. Returns false if they don't fit.
+static bool mvee_shm_log_changed_blocks(const mvee_shm_table_entry* mapping, const void* shm, size_t size, char* buf)
+{
+  size_t bitmap_size = mvee_shm_block_bitmap_size(size);
+  unsigned char* bitmap = (unsigned char*) buf;
+  char* data = buf + bitmap_size;
+  const void* shadow = SHARED_TO_SHADOW_POINTER(mapping, shm);
+
+  orig_memset(bitmap, 0, bitmap_size);
+  for (size_t block = 0, offset = 0; offset < size; block++, offset += MVEE_SHM_BLOCK_SIZE)
+  {
+    size_t len = size - offset < MVEE_SHM_BLOCK_SIZE ? size - offset : MVEE_SHM_BLOCK_SIZE;
+    if (!orig_memcmp(shm + offset, shadow + offset, len))
+      continue;
+
+    if (data + len > buf + size)
+      return false;
+
+    bitmap[block / 8] |= 1 << (block % 8);
+    orig_memcpy(data, shm + offset, len);
+    data += len;
+  }
+
+  return true;
+}
+
+// All variants: assembles the copy of [shm, shm + size[ from the shadow and
+// the blocks logged in buf. Writes it to dest and/or dest_shadow, either of
+// which may be NULL, and updates the shadow with the logged blocks.
+static void mvee_shm_copy_logged_blocks(void* dest, void* dest_shadow, const mvee_shm_table_entry* mapping, const void* shm, size_t size, const char* buf)
+{
+  const unsigned char* bitmap = (const unsigned char*) buf;
+  const char* data = buf + mvee_shm_block_bitmap_size(size);
+  void* shadow = SHARED_TO_SHADOW_POINTER(mapping, shm);
+
+  for (size_t block = 0, offset = 0; offset < size; block++, offset += MVEE_SHM_BLOCK_SIZE)
+  {
+    size_t len = size - offset < MVEE_SHM_BLOCK_SIZE ? size - offset : MVEE_SHM_BLOCK_SIZE;
+    const void* src = shadow + offset;
+    if (bitmap[block / 8] & (1 << (block % 8)))
+    {
+      src = data;
+      data += len;
+    }
+
+    if (dest)
+      orig_memcpy(dest + offset, src, len);
+    if (dest_shadow)
+      orig_memcpy(dest_shadow + offset, src, len);
+    if (src != shadow + offset)
+      orig_memcpy(shadow + offset, src, len);
+  }
+}
+
 // type         : type of operation
 // in_address   : the input address from which can be read, which might be on the SHM page
 // in           : the SHM metadata for the input address, or NULL if it isn't in shared memory
@@ -511,13 +970,16 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
     entry->value = value;
     entry->cmp = cmp;
     entry->type = type;
+    // The entry might be reused, so these aren't necessarily zero
+    entry->nr_of_variants_checked = 1;
+    entry->replication_type = 0;
 
     /* The input comes from a non-SHM page, fill in the buffer */
     if (unlikely(!in && ((type == MEMCPY) || (type == MEMMOVE))))
       orig_memcpy(&entry->data, in_address, size);
 
     // Signal to followers that entry is available
-    orig_atomic_store_release(&entry->nr_of_variants_checked, 1);
+    mvee_shm_publish_entry(entry);
 
     ////////////////////////////////////////////////////////////////////////////////
     // Unique access: leader does access (on actual and shadow memory),
@@ -526,10 +988,19 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
 
     // Wait for followers to signal they finished checking. This is only necessary when we might write to shm (aka, when 'out' has a value).
     if (out)
-        while (orig_atomic_load_acquire(&entry->nr_of_variants_checked) != mvee_num_variants)
-            arch_cpu_relax();
+    {
+      if (mvee_shm_check_window && (type == STORE || type == MEMCPY || type == MEMMOVE || type == MEMSET))
+        mvee_shm_defer_checks(entry);
+      else
+      {
+        // This implies all older entries have been checked too
+        mvee_shm_wait_for_checks(entry);
+        mvee_shm_unchecked_count = 0;
+      }
+    }
 
     bool data_in_buffer = false;
+    bool blocks_in_buffer = false;
     switch(type)
     {
       case LOAD:
@@ -580,12 +1051,25 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
               /* If there is a shadow copy, check whether it differs from our local copy or not. If it doesn't, we use our local copy as input.
                * If it **does** differ, we copy the modified data on the SHM page to the buffer, and use that copy as input.
                */
-              if (in->shadow)
+              if (in->shadow && type == MEMCPY && size >= MVEE_SHM_BLOCK_MIN_COPY)
+              {
+                /* Large copy, only log the blocks that differ */
+                blocks_in_buffer = mvee_shm_log_changed_blocks(in, in_address, size, entry->data);
+                data_in_buffer = !blocks_in_buffer;
+              }
+              else if (in->shadow)
                 data_in_buffer = orig_memcmp(SHARED_TO_SHADOW_POINTER(in, in_address), in_address, size);
               /* If no shadow memory, always use buffer */
               else
                 data_in_buffer = true;
 
+              if (blocks_in_buffer)
+              {
+                mvee_shm_copy_logged_blocks(out_address, (out && out->shadow) ? SHARED_TO_SHADOW_POINTER(out, out_address) : NULL,
+                    in, in_address, size, entry->data);
+                break;
+              }
+
               if (data_in_buffer)
                 orig_memcpy(&entry->data, in_address, size);
               const void* buf_or_shadow = data_in_buffer ? &entry->data : SHARED_TO_SHADOW_POINTER(in, in_address);
@@ -751,7 +1235,7 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
 
     // Signal followers that replication data (or the sign of its absence) is available. Only necessary when actually reading from shm (aka, when 'in' has a value).
     if (in)
-      orig_atomic_store_release(&entry->replication_type, data_in_buffer ? 2 : 1);
+      orig_atomic_store_release(&entry->replication_type, data_in_buffer ? 2 : (blocks_in_buffer ? 3 : 1));
   }
   else
   {
@@ -760,8 +1244,7 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
     ////////////////////////////////////////////////////////////////////////////////
 
     // Wait for leader to signal availability of the entry
-    while (!orig_atomic_load_acquire(&entry->nr_of_variants_checked))
-        arch_cpu_relax();
+    mvee_shm_wait_for_entry(entry);
 
     // Assert we're on the same entry
     mvee_assert_same_address(entry->address, shm_address);
@@ -816,10 +1299,18 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
     // Wait for leader to signal that replication data is available. Only necessary when actually reading from shm (aka, when 'in' has a value).
     unsigned char replication_type = 0;
     if (in)
+    {
+        unsigned int waited = 0;
         while ((replication_type = orig_atomic_load_acquire(&entry->replication_type)) == 0)
+        {
+            mvee_stats_count_backoff(waited++, MVEE_STATS_SPIN);
             arch_cpu_relax();
+        }
+        mvee_stats_wait_end(waited);
+    }
 
     bool data_in_buffer = (replication_type == 2);
+    bool blocks_in_buffer = (replication_type == 3);
     switch(type)
     {
       case LOAD:
@@ -841,7 +1332,14 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
       case MEMCPY:
       case MEMMOVE:
         {
-          if (in)
+          if (in && blocks_in_buffer)
+          {
+            /* Assemble the copy from our shadow and the blocks the leader logged */
+            void* dest = out ? NULL : out_address;
+            void* dest_shadow = (out && out->shadow) ? SHARED_TO_SHADOW_POINTER(out, out_address) : NULL;
+            mvee_shm_copy_logged_blocks(dest, dest_shadow, in, in_address, size, entry->data);
+          }
+          else if (in)
           {
             /* The input comes from a SHM page. Check whether to read from the buffer or from the local shadow copy. */
             const void* buf_or_shadow = data_in_buffer ? &entry->data : SHARED_TO_SHADOW_POINTER(in, in_address);
@@ -964,11 +1462,75 @@ static inline mvee_shm_op_ret mvee_shm_buffered_op(const unsigned char type, con
       default:
         mvee_error_unsupported_operation(type);
     }
+
+    mvee_shm_consume_entry();
   }
 
   return ret;
 }
 
+static void mvee_shm_flush_stores(void)
+{
+  size_t size = mvee_shm_wc_size;
+  if (!size)
+    return;
+
+  mvee_shm_table_entry* entry = mvee_shm_table_get_entry(mvee_shm_wc_mapping);
+  if (unlikely(!entry))
+    mvee_error_shm_entry_not_present(mvee_shm_wc_start);
+
+  // Clear the batch first, buffered_op would flush it again otherwise
+  mvee_shm_wc_size = 0;
+  mvee_shm_buffered_op(MEMCPY, mvee_shm_wc_data, NULL, mvee_shm_wc_start, entry, size, 0, 0);
+}
+
+void mvee_shm_complete_deferred_ops(void)
+{
+  mvee_shm_flush_stores();
+  if (likely(mvee_master_variant))
+    mvee_shm_drain_checks();
+}
+
+// Called through MVEE_SYSCALL_BOUNDARY (sysdeps/unix/sysdep.h) before the
+// cancellable syscalls, and by _exit, while mvee_shm_syscall_hook is set. The
+// followers must have checked our writes before data based on them can leave
+// the process. This is also a quiescent point for the SHM table.
+void mvee_shm_syscall_boundary(void)
+{
+  mvee_shm_complete_deferred_ops();
+  mvee_shm_table_quiescent();
+}
+
+// Called by mvee_thread_teardown when a thread exits
+void mvee_shm_thread_teardown(void)
+{
+  mvee_shm_complete_deferred_ops();
+  mvee_shm_table_unregister_reader();
+}
+
+// Returns false if the store can't be combined and must be done right away
+static inline bool mvee_shm_combine_store(void* address, const mvee_shm_table_entry* entry, unsigned long value, unsigned long size)
+{
+  if (mvee_shm_wc_size &&
+      (entry->address != mvee_shm_wc_mapping ||
+       address != mvee_shm_wc_start + mvee_shm_wc_size ||
+       mvee_shm_wc_size + size > MVEE_SHM_WC_MAX))
+    mvee_shm_flush_stores();
+
+  if (!mvee_shm_wc_size)
+  {
+    if (((unsigned long) address & (sizeof(void*) - 1)) || size > sizeof(value))
+      return false;
+    mvee_shm_wc_start   = address;
+    mvee_shm_wc_mapping = entry->address;
+  }
+
+  // Stores write the lower bytes of value
+  orig_memcpy(mvee_shm_wc_data + mvee_shm_wc_size, &value, size);
+  mvee_shm_wc_size += size;
+  return true;
+}
+
 // ========================================================================================================================
 // The mvee_shm_op interface used by the wrapping shm_support compiler pass
 // ========================================================================================================================
@@ -988,8 +1550,11 @@ mvee_shm_op_ret mvee_shm_op(unsigned char id, void* address, unsigned long size,
     case LOAD:
       mvee_shm_buffered_op(id, address, entry, &ret.val, NULL, size, 0, 0);
       break;
-    case ATOMICSTORE:
     case STORE:
+      if (mvee_shm_write_combining && mvee_shm_combine_store(address, entry, value, size))
+        break;
+      // fall through
+    case ATOMICSTORE:
       mvee_shm_buffered_op(id, NULL, NULL, address, entry, size, value, 0);
       break;
     case ATOMICCMPXCHG:
@@ -1166,12 +1731,12 @@ mvee_shm_memcmp (const void *s1, const void *s2, size_t len)
     entry->value = orig_memcmp(shm_s1, shm_s2, len);
     orig_atomic_store_release(&entry->nr_of_variants_checked, 1);
     orig_atomic_store_release(&entry->replication_type, replication_type);
+    mvee_shm_publish_entry(entry);
   }
   else
   {
     // Wait until entry is ready
-    while (!orig_atomic_load_acquire(&entry->replication_type))
-        arch_cpu_relax();
+    mvee_shm_wait_for_entry(entry);
 
     // Check entry
     mvee_assert_same_address(entry->address, (s1_entry ? shm_s1 : shm_s2));
@@ -1203,6 +1768,8 @@ mvee_shm_memcmp (const void *s1, const void *s2, size_t len)
 
     // the return value for memcmp should be the same
     mvee_assert_same_value1(entry->value, return_value);
+    mvee_shm_consume_entry();
+    return return_value;
   }
 
   return entry->value;
@@ -1232,20 +1799,24 @@ mvee_shm_strcmp (const char *str1, const char *str2)
     *(int*)entry->data = orig_strcmp(str1_entry ? shm_str1 : str1, str2_entry ? shm_str2 : str2);
     orig_atomic_store_release(&entry->nr_of_variants_checked, 1);
     orig_atomic_store_release(&entry->replication_type, 2);
+    mvee_shm_publish_entry(entry);
   }
   else
   {
     // Wait until entry is ready
-    while (!orig_atomic_load_acquire(&entry->replication_type))
-        arch_cpu_relax();
+    mvee_shm_wait_for_entry(entry);
 
     // Check entry
     mvee_assert_same_address(entry->address, (str1_entry ? shm_str1 : shm_str2));
     mvee_assert_same_address(entry->second_address, ((str1_entry && str2_entry) ? shm_str2 : NULL));
     mvee_assert_same_type(entry->type, STRCMP);
+
+    int result = *(int*)entry->data;
+    mvee_shm_consume_entry();
+    return result;
   }
 
-  return entry->value;
+  return *(int*)entry->data;
 }
 
 size_t
@@ -1270,21 +1841,217 @@ mvee_shm_strlen (const char *str)
     *(size_t*)entry->data = orig_strlen(shm_str);
     orig_atomic_store_release(&entry->nr_of_variants_checked, 1);
     orig_atomic_store_release(&entry->replication_type, 2);
+    mvee_shm_publish_entry(entry);
   }
   else
   {
     // Wait until entry is ready
-    while (!orig_atomic_load_acquire(&entry->replication_type))
-        arch_cpu_relax();
+    mvee_shm_wait_for_entry(entry);
 
     // Check entry
     mvee_assert_same_type(entry->type, STRLEN);
     mvee_assert_same_address(entry->address, shm_str);
+
+    size_t result = *(size_t*)entry->data;
+    mvee_shm_consume_entry();
+    return result;
   }
 
   return *(size_t*)entry->data;
 }
 
+// ========================================================================================================================
+// Calls that only read SHM. The leader does the call on the SHM mapping and
+// replicates the result, so each call takes a single entry. Like in strlen,
+// we don't bother with the shadow mappings.
+// ========================================================================================================================
+
+// Leader: fills in the entry and publishes the result
+static inline void mvee_shm_publish_result(mvee_shm_op_entry* entry, unsigned char type, const void* address,
+    const void* second_address, size_t size, uint64_t value, unsigned long result)
+{
+  entry->address = address;
+  entry->second_address = second_address;
+  entry->size = size;
+  entry->value = value;
+  entry->type = type;
+  entry->nr_of_variants_checked = 1;
+  entry->replication_type = 2;
+  *(unsigned long*)entry->data = result;
+  mvee_shm_publish_entry(entry);
+}
+
+// Follower: checks that we're doing the same call and returns the leader's result
+static inline unsigned long mvee_shm_receive_result(mvee_shm_op_entry* entry, unsigned char type, const void* address,
+    const void* second_address, size_t size, uint64_t value)
+{
+  mvee_shm_wait_for_entry(entry);
+
+  mvee_assert_same_type(entry->type, type);
+  mvee_assert_same_address(entry->address, address);
+  mvee_assert_same_address(entry->second_address, second_address);
+  mvee_assert_same_size(entry->size, size);
+  mvee_assert_same_value1(entry->value, value);
+
+  unsigned long result = *(unsigned long*)entry->data;
+  mvee_shm_consume_entry();
+  return result;
+}
+
+// Pointer results are replicated as an offset from the argument
+#define MVEE_SHM_NO_MATCH (~0ul)
+
+static inline unsigned long mvee_shm_match_offset(const void* match, const void* start)
+{
+  return match ? (unsigned long)(match - start) : MVEE_SHM_NO_MATCH;
+}
+
+static inline void* mvee_shm_match_pointer(const void* start, unsigned long offset)
+{
+  return offset == MVEE_SHM_NO_MATCH ? NULL : (void*)start + offset;
+}
+
+// Search functions with a single string argument. type selects the function.
+static unsigned long mvee_shm_search(unsigned char type, const void* str, int c, size_t n)
+{
+  const void* shm_str = mvee_shm_decode_address(str);
+  mvee_shm_table_entry* shm_entry = mvee_shm_table_get_entry(shm_str);
+  if (unlikely(!shm_entry))
+    mvee_error_shm_entry_not_present(str);
+
+  mvee_shm_op_entry* entry = mvee_shm_get_entry(sizeof(unsigned long));
+  if (unlikely(!mvee_master_variant))
+    return mvee_shm_receive_result(entry, type, shm_str, NULL, n, c);
+
+  unsigned long result = 0;
+  switch (type)
+  {
+    case STRNLEN:
+      result = orig_strnlen(shm_str, n);
+      break;
+    case STRCHR:
+      result = mvee_shm_match_offset(orig_strchr(shm_str, c), shm_str);
+      break;
+    case STRRCHR:
+      result = mvee_shm_match_offset(orig_strrchr(shm_str, c), shm_str);
+      break;
+    case RAWMEMCHR:
+      result = mvee_shm_match_offset(orig_rawmemchr(shm_str, c), shm_str);
+      break;
+    case MEMRCHR:
+      result = mvee_shm_match_offset(orig_memrchr(shm_str, c, n), shm_str);
+      break;
+    default:
+      mvee_error_unsupported_operation(type);
+  }
+
+  mvee_shm_publish_result(entry, type, shm_str, NULL, n, c, result);
+  return result;
+}
+
+size_t
+mvee_shm_strnlen (const char *str, size_t maxlen)
+{
+  return mvee_shm_search(STRNLEN, str, 0, maxlen);
+}
+
+char *
+mvee_shm_strchr (const char *str, int c)
+{
+  return mvee_shm_match_pointer(str, mvee_shm_search(STRCHR, str, c, 0));
+}
+
+char *
+mvee_shm_strrchr (const char *str, int c)
+{
+  return mvee_shm_match_pointer(str, mvee_shm_search(STRRCHR, str, c, 0));
+}
+
+void *
+mvee_shm_rawmemchr (const void *src, int c)
+{
+  return mvee_shm_match_pointer(src, mvee_shm_search(RAWMEMCHR, src, c, 0));
+}
+
+void *
+mvee_shm_memrchr (const void *src, int c, size_t n)
+{
+  return mvee_shm_match_pointer(src, mvee_shm_search(MEMRCHR, src, c, n));
+}
+
+int
+mvee_shm_strncmp (const char *str1, const char *str2, size_t n)
+{
+  /* Decode addresses */
+  const char* shm_str1 = mvee_shm_decode_address(str1);
+  const char* shm_str2 = mvee_shm_decode_address(str2);
+  mvee_shm_table_entry* str1_entry = mvee_shm_table_get_entry(shm_str1);
+  mvee_shm_table_entry* str2_entry = mvee_shm_table_get_entry(shm_str2);
+  if (unlikely(!str1_entry && !str2_entry))
+    mvee_error_shm_entry_not_present(str1);
+
+  const void* address = str1_entry ? shm_str1 : shm_str2;
+  const void* second_address = (str1_entry && str2_entry) ? shm_str2 : NULL;
+
+  mvee_shm_op_entry* entry = mvee_shm_get_entry(sizeof(unsigned long));
+  if (unlikely(!mvee_master_variant))
+    return (int) mvee_shm_receive_result(entry, STRNCMP, address, second_address, n, 0);
+
+  int result = orig_strncmp(str1_entry ? shm_str1 : str1, str2_entry ? shm_str2 : str2, n);
+  mvee_shm_publish_result(entry, STRNCMP, address, second_address, n, 0, (unsigned long) result);
+  return result;
+}
+
+// ========================================================================================================================
+// Copies of strings. We need the length of the source string first. If the
+// source is in SHM, that takes an extra entry.
+// ========================================================================================================================
+static inline size_t mvee_shm_copy_length(const char* src, size_t maxlen)
+{
+  if ((unsigned long long) src & 0x8000000000000000ull)
+    return mvee_shm_strnlen(src, maxlen);
+  return orig_strnlen(src, maxlen);
+}
+
+void *
+mvee_shm_mempcpy (void *__restrict dest, const void *__restrict src, size_t n)
+{
+  return mvee_shm_memcpy(dest, src, n) + n;
+}
+
+char *
+mvee_shm_stpcpy (char *__restrict dest, const char *__restrict src)
+{
+  size_t len = mvee_shm_copy_length(src, SIZE_MAX);
+  mvee_shm_memcpy(dest, src, len + 1);
+  return dest + len;
+}
+
+char *
+mvee_shm_strcpy (char *__restrict dest, const char *__restrict src)
+{
+  mvee_shm_stpcpy(dest, src);
+  return dest;
+}
+
+char *
+mvee_shm_strncpy (char *__restrict dest, const char *__restrict src, size_t n)
+{
+  size_t len = mvee_shm_copy_length(src, n);
+  if (len)
+    mvee_shm_memcpy(dest, src, len);
+
+  // Pad with zeroes
+  if (len < n)
+  {
+    if ((unsigned long long) dest & 0x8000000000000000ull)
+      mvee_shm_memset(dest + len, 0, n - len);
+    else
+      orig_memset(dest + len, 0, n - len);
+  }
+  return dest;
+}
+
 // ========================================================================================================================
 // Hooks for mmap and related functions
 // ========================================================================================================================
@@ -1341,6 +2108,9 @@ mvee_shm_shmdt (const void *shmaddr)
 {
   if ((unsigned long long) shmaddr & 0x8000000000000000ull)
   {
+    // Held back stores and checks might concern this mapping
+    mvee_shm_complete_deferred_ops();
+
     mvee_shm_table_entry* mapping = mvee_shm_table_get_entry(mvee_shm_decode_address(shmaddr));
     if (!mapping)
       mvee_error_shm_entry_not_present(shmaddr);
@@ -1357,6 +2127,9 @@ mvee_shm_munmap (const void *addr, size_t len)
 {
   if ((unsigned long long) addr & 0x8000000000000000ull)
   {
+    // Held back stores and checks might concern this mapping
+    mvee_shm_complete_deferred_ops();
+
     mvee_shm_table_entry* mapping = mvee_shm_table_get_entry(mvee_shm_decode_address(addr));
     if (!mapping)
       mvee_error_shm_entry_not_present(addr);
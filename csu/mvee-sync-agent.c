@@ -1,16 +1,425 @@
 #include "mvee-agent-shared.h"
 
 #include <atomic.h>
+#include <ldsodefs.h>
+#include <mmap_internal.h>
 #include <stddef.h>
+#include <sys/mman.h>
+#include <sysdep.h>
+#include <tls.h>
 #include <unistd.h>
 
+#include "mvee-agent-stats.h"
+#include "mvee-thread-control.h"
+
 unsigned char                  mvee_libc_initialized         = 0;
 unsigned char                  mvee_master_variant           = 0;
 unsigned char                  mvee_sync_enabled             = 0;
 unsigned short                 mvee_num_variants             = 0;
+unsigned short                 mvee_my_variant_num           = 0;
+unsigned char                  mvee_ring_buffers             = 0;
+unsigned char                  mvee_private_memory           = 0;
+unsigned char                  mvee_load_replication         = 0;
+unsigned char                  mvee_lock_replication         = 0;
+unsigned char                  mvee_shm_write_combining      = 0;
+unsigned int                   mvee_shm_check_window         = 0;
+// set if the SHM agent may hold back stores or checks
+unsigned char                  mvee_shm_deferred_ops         = 0;
+// set if syscalls must call mvee_shm_syscall_boundary first
+unsigned char                  mvee_shm_syscall_hook         = 0;
+#ifdef MVEE_SLAVE_YIELD
+unsigned char                  mvee_wait_policy              = MVEE_WAIT_YIELD;
+#else
+unsigned char                  mvee_wait_policy              = MVEE_WAIT_SPIN;
+#endif
+unsigned int                   mvee_spin_count               = 1024;
+unsigned int                   mvee_yield_count              = 16;
+// 0: no call site checks, N: check the call site of every Nth replicated operation
+unsigned int                   mvee_call_site_checks         = 0;
+// The total/partial agent used to be built with MVEE_CHECK_LOCK_TYPE, so we keep those checks on by default
+unsigned char                  mvee_check_level              = MVEE_CHECK_OP_TYPE;
+// Cleared at startup if we're not running under the MVEE. Until then, we
+// assume that we are, so everything that runs before __libc_start_main still
+// takes the replicated paths.
+unsigned char                  mvee_hooks_enabled            = 1;
+static signed char             mvee_monitor_state            = -1;
+
+// ========================================================================================================================
+// MONITOR DETECTION
+// ========================================================================================================================
+
+//
+// Asks the MVEE whether we run under its control and caches the answer. We
+// only issue the fake syscall once. The first caller is typically an IFUNC
+// resolver in the string functions, while we're still being relocated, so
+// this must not touch errno, go through the PLT or use the stack protector.
+// Returns 1 if we're running under the MVEE.
+//
+unsigned char inhibit_stack_protector mvee_detect_monitor(void)
+{
+	if (mvee_monitor_state < 0)
+	{
+		INTERNAL_SYSCALL_DECL(err);
+		long res = INTERNAL_SYSCALL_NCS(MVEE_RUNS_UNDER_MVEE_CONTROL, err, 6,
+										&mvee_sync_enabled, &mvee_infinite_loop,
+										&mvee_num_variants, &mvee_my_variant_num,
+										&mvee_master_variant, &mvee_shm_tag);
+		mvee_monitor_state = INTERNAL_SYSCALL_ERROR_P(res, err) ? 0 : 1;
+		mvee_hooks_enabled = mvee_monitor_state;
+	}
+	return mvee_monitor_state;
+}
+
+// ========================================================================================================================
+// THREAD-PRIVATE MEMORY
+// ========================================================================================================================
+
+//
+// Synchronization operations on memory that no other thread can access need
+// not be ordered. We always skip the ranges a thread registered through
+// mvee_register_private_range. With glibc.mvee.private_memory=1, we also skip
+// the calling thread's static TLS block. We never skip the struct pthread
+// itself: other threads do access it (e.g., joinid, cancelhandling and the
+// tid the kernel clears).
+//
+// We do not skip the stack. Objects on it are shared more often than one
+// would think, even within glibc: setxid keeps its struct xid_command on the
+// caller's stack, and every other thread decrements __cmd.cntr and sets
+// __cmd.error from its SIGSETXID handler.
+//
+// All variants classify the same operations as private, since they are
+// semantically equivalent.
+//
+#define MVEE_MAX_PRIVATE_RANGES  8
+#define MVEE_PRIVATE_STATS_BATCH 4096
+
+enum mvee_private_kinds
+{
+	MVEE_PRIVATE_TLS        = 0,
+	MVEE_PRIVATE_REGISTERED = 1,
+	MVEE_PRIVATE_NONE       = 2  // the operation is replicated
+};
+
+struct mvee_private_range
+{
+	unsigned long start;
+	unsigned long end;
+};
+
+// Not static: the monitor looks this up. The number of operations we've
+// classified, per kind, if glibc.mvee.stats is set. Threads add their counts
+// in batches.
+unsigned long                         mvee_private_ops[MVEE_PRIVATE_NONE + 1];
+
+static __thread struct mvee_private_range mvee_private_ranges[MVEE_MAX_PRIVATE_RANGES];
+static __thread unsigned int          mvee_private_range_count      = 0;
+static __thread unsigned long         mvee_private_tls_lo           = 0;
+static __thread unsigned long         mvee_private_tls_hi           = 0;
+static __thread unsigned long         mvee_private_ops_local[MVEE_PRIVATE_NONE + 1];
+static __thread unsigned int          mvee_private_ops_pending      = 0;
+
+static void __attribute__((noinline)) mvee_private_init_thread(void)
+{
+	struct pthread* self = THREAD_SELF;
+
+	// The static TLS block sits right below the TCB
+	mvee_private_tls_hi = (unsigned long) self;
+	mvee_private_tls_lo = mvee_private_tls_hi + TLS_TCB_SIZE - GLRO(dl_tls_static_size);
+}
+
+static void __attribute__((noinline)) mvee_private_flush_stats(void)
+{
+	for (int i = 0; i <= MVEE_PRIVATE_NONE; ++i)
+	{
+		orig_atomic_add(&mvee_private_ops[i], mvee_private_ops_local[i]);
+		mvee_private_ops_local[i] = 0;
+	}
+	mvee_private_ops_pending = 0;
+}
+
+//
+// Returns 1 if no other thread can access @word_ptr
+//
+static inline unsigned char mvee_word_is_private(volatile void* word_ptr)
+{
+	unsigned long addr = (unsigned long) word_ptr;
+	unsigned int kind = MVEE_PRIVATE_NONE;
+
+	if (mvee_private_memory)
+	{
+		if (unlikely(!mvee_private_tls_hi))
+			mvee_private_init_thread();
+
+		if (addr >= mvee_private_tls_lo && addr < mvee_private_tls_hi)
+			kind = MVEE_PRIVATE_TLS;
+	}
+
+	if (kind == MVEE_PRIVATE_NONE)
+	{
+		for (unsigned int i = 0; i < mvee_private_range_count; ++i)
+		{
+			if (addr >= mvee_private_ranges[i].start && addr < mvee_private_ranges[i].end)
+			{
+				kind = MVEE_PRIVATE_REGISTERED;
+				break;
+			}
+		}
+	}
+
+	if (unlikely(mvee_stats_enabled))
+	{
+		mvee_private_ops_local[kind]++;
+		if (unlikely(++mvee_private_ops_pending >= MVEE_PRIVATE_STATS_BATCH))
+			mvee_private_flush_stats();
+	}
+
+	return kind != MVEE_PRIVATE_NONE;
+}
+
+//
+// Tells the agent that the calling thread is the only one that accesses
+// [@start, @start + @len[. Returns -1 if the thread has too many ranges.
+//
+int mvee_register_private_range(const void* start, unsigned long len)
+{
+	if (mvee_private_range_count >= MVEE_MAX_PRIVATE_RANGES)
+		return -1;
+
+	mvee_private_ranges[mvee_private_range_count].start = (unsigned long) start;
+	mvee_private_ranges[mvee_private_range_count].end   = (unsigned long) start + len;
+	mvee_private_range_count++;
+	return 0;
+}
+
+void mvee_unregister_private_range(const void* start)
+{
+	for (unsigned int i = 0; i < mvee_private_range_count; ++i)
+	{
+		if (mvee_private_ranges[i].start == (unsigned long) start)
+		{
+			mvee_private_ranges[i] = mvee_private_ranges[--mvee_private_range_count];
+			return;
+		}
+	}
+}
+
+// ========================================================================================================================
+// STATISTICS
+// ========================================================================================================================
+
+unsigned char                         mvee_stats_enabled            = 0;
+__thread struct mvee_thread_stats*    mvee_thread_stats             = NULL;
+// Shared by the threads that couldn't map a page of their own. Not registered.
+static struct mvee_thread_stats       mvee_stats_fallback;
+
+//
+// Maps and registers the statistics page for the calling thread. Called by the
+// first mvee_stats() in every thread, so this must not take any locks.
+//
+struct mvee_thread_stats* __attribute__((noinline)) mvee_stats_attach(void)
+{
+	struct mvee_thread_stats* stats = (struct mvee_thread_stats*) orig_MMAP_CALL(NULL, MVEE_STATS_PAGE_SIZE, PROT_READ | PROT_WRITE,
+																				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (stats == MAP_FAILED)
+	{
+		stats = &mvee_stats_fallback;
+	}
+	else
+	{
+		stats->version = MVEE_STATS_VERSION;
+		stats->size    = sizeof(struct mvee_thread_stats);
+		syscall(MVEE_REGISTER_STATS_PAGE, stats, MVEE_STATS_PAGE_SIZE);
+	}
+
+	// A forked child registers a page of its own
+	syscall(MVEE_RESET_ATFORK, &mvee_thread_stats, sizeof(mvee_thread_stats));
+	mvee_thread_stats = stats;
+	return stats;
+}
+
+//
+// Unregisters and unmaps the calling thread's statistics page. The MVEE takes
+// its final snapshot of the counters when we unregister. Anything the thread
+// still counts after this goes to the fallback page.
+//
+static void mvee_stats_detach(void)
+{
+	struct mvee_thread_stats* stats = mvee_thread_stats;
+
+	if (!stats || stats == &mvee_stats_fallback)
+		return;
+
+	mvee_thread_stats = &mvee_stats_fallback;
+	syscall(MVEE_REGISTER_STATS_PAGE, NULL, 0);
+	orig_MUNMAP_CALL(stats, MVEE_STATS_PAGE_SIZE);
+}
+
+// ========================================================================================================================
+// CALL SITE CHECKS
+// ========================================================================================================================
+
+// nr of replicated operations since this thread last checked a call site
+static __thread unsigned int          mvee_call_site_count          = 0;
+
+//
+// Returns 1 if the calling thread should check the call site of the operation
+// it's about to replicate. Every thread samples its own operations, and does
+// so in the same way in every variant.
+//
+static inline unsigned char mvee_should_check_call_site(void)
+{
+	if (likely(!mvee_call_site_checks))
+		return 0;
+	if (++mvee_call_site_count < mvee_call_site_checks)
+		return 0;
+	mvee_call_site_count = 0;
+	return 1;
+}
+
+//
+// Call sites for operations requested through the public API. We don't know
+// the source line there, but the page offset of the return address is the
+// same in every variant.
+//
+#define MVEE_EXTERNAL_CALL_SITE() \
+	((unsigned int)((unsigned long)__builtin_return_address(0) & 0xfff))
+
+static void __attribute__((noinline)) mvee_call_site_mismatch(unsigned short op_type, unsigned int leader_site, unsigned int our_site)
+{
+	syscall(__NR_gettid, 1337, 10000001, 90, op_type, leader_site, our_site);
+}
 
 #ifdef MVEE_USE_TOTALPARTIAL_AGENT
 #include "mvee-totalpartial-agent.c"
 #else
 #include "mvee-woc-agent.c"
 #endif
+
+// ========================================================================================================================
+// THREAD CONTROL BLOCK
+// ========================================================================================================================
+
+__thread struct mvee_thread_state     mvee_thread_state;
+// set if the MVEE doesn't know MVEE_GET_THREAD_CONTROL
+static unsigned char                  mvee_thread_control_unsupported = 0;
+
+//
+// Returns the calling thread's control block (see mvee-thread-control.h), or
+// NULL if we can't get one. Only the first call in every thread asks the MVEE.
+//
+struct mvee_thread_control* mvee_get_thread_control(void)
+{
+	struct mvee_thread_control* control = &mvee_thread_state.control;
+
+	if (likely(control->version))
+		return control;
+
+	if (unlikely(mvee_thread_control_unsupported) || !mvee_detect_monitor())
+		return NULL;
+
+	control->version = MVEE_THREAD_CONTROL_VERSION;
+	control->size    = sizeof(struct mvee_thread_control);
+	mvee_agent_describe_thread(control);
+
+	if (syscall(MVEE_GET_THREAD_CONTROL, control, sizeof(*control), &mvee_thread_state, sizeof(mvee_thread_state)) < 0)
+	{
+		control->version = 0;
+		mvee_thread_control_unsupported = 1;
+		return NULL;
+	}
+
+	return control;
+}
+
+//
+// Sets up the calling thread with a single fake syscall, before its first
+// replicated operation. Called for new threads by start_thread, and for the
+// main thread by mvee_agent_init. Anything we don't set up here is still set
+// up on first use.
+//
+void mvee_thread_bootstrap(void)
+{
+	if (mvee_get_thread_control())
+		mvee_agent_attach_thread();
+}
+
+//
+// Called by start_thread after the thread's destructors have run. Does the SHM
+// operations the thread still holds back, since nothing else would once the
+// thread is gone, gives up its SHM table reader slot and releases its
+// statistics page.
+//
+void mvee_thread_teardown(void)
+{
+	mvee_shm_thread_teardown();
+	mvee_stats_detach();
+}
+
+#if HAVE_TUNABLES
+# define TUNABLE_NAMESPACE mvee
+# include <elf/dl-tunables.h>
+
+// The callbacks only run for tunables that were actually set, so the
+// compile-time defaults above remain in effect otherwise.
+# define MVEE_TUNABLE_CALLBACK_FNDECL(__name, __var, __type)	\
+static void													\
+TUNABLE_CALLBACK (__name) (tunable_val_t *valp)				\
+{															\
+	__var = (__type) (valp)->numval;						\
+}
+
+MVEE_TUNABLE_CALLBACK_FNDECL (set_wait_policy, mvee_wait_policy, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_spin_count, mvee_spin_count, unsigned int)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_yield_count, mvee_yield_count, unsigned int)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_ring_buffers, mvee_ring_buffers, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_private_memory, mvee_private_memory, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_shm_write_combining, mvee_shm_write_combining, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_shm_check_window, mvee_shm_check_window, unsigned int)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_stats, mvee_stats_enabled, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_call_site_checks, mvee_call_site_checks, unsigned int)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_check_level, mvee_check_level, unsigned char)
+# ifndef MVEE_USE_TOTALPARTIAL_AGENT
+MVEE_TUNABLE_CALLBACK_FNDECL (set_load_replication, mvee_load_replication, unsigned char)
+MVEE_TUNABLE_CALLBACK_FNDECL (set_lock_replication, mvee_lock_replication, unsigned char)
+# endif
+# ifndef MVEE_USE_TOTALPARTIAL_AGENT
+MVEE_TUNABLE_CALLBACK_FNDECL (set_clock_count, mvee_clock_count, unsigned int)
+# endif
+#endif
+
+/* Reads the agent configuration and sets up the agent. Must be called right
+   after we've asked the MVEE whether we run under its control, and before
+   the first replicated operation. */
+void mvee_agent_init(void)
+{
+#if HAVE_TUNABLES
+	TUNABLE_GET (wait_policy, int32_t, TUNABLE_CALLBACK (set_wait_policy));
+	TUNABLE_GET (spin_count, int32_t, TUNABLE_CALLBACK (set_spin_count));
+	TUNABLE_GET (yield_count, int32_t, TUNABLE_CALLBACK (set_yield_count));
+	TUNABLE_GET (ring_buffers, int32_t, TUNABLE_CALLBACK (set_ring_buffers));
+	TUNABLE_GET (private_memory, int32_t, TUNABLE_CALLBACK (set_private_memory));
+	TUNABLE_GET (shm_write_combining, int32_t, TUNABLE_CALLBACK (set_shm_write_combining));
+	TUNABLE_GET (shm_check_window, int32_t, TUNABLE_CALLBACK (set_shm_check_window));
+	TUNABLE_GET (stats, int32_t, TUNABLE_CALLBACK (set_stats));
+	TUNABLE_GET (call_site_checks, int32_t, TUNABLE_CALLBACK (set_call_site_checks));
+	TUNABLE_GET (check_level, int32_t, TUNABLE_CALLBACK (set_check_level));
+# ifndef MVEE_USE_TOTALPARTIAL_AGENT
+	TUNABLE_GET (load_replication, int32_t, TUNABLE_CALLBACK (set_load_replication));
+	TUNABLE_GET (lock_replication, int32_t, TUNABLE_CALLBACK (set_lock_replication));
+# endif
+# ifndef MVEE_USE_TOTALPARTIAL_AGENT
+	TUNABLE_GET (clock_count, int32_t, TUNABLE_CALLBACK (set_clock_count));
+# endif
+#endif
+	// Natively, there's nobody to replicate loads or locks to, read statistics or check call sites
+	if (!mvee_hooks_enabled)
+		mvee_load_replication = mvee_lock_replication = mvee_stats_enabled = mvee_call_site_checks = mvee_check_level = 0;
+	else if (mvee_check_level >= MVEE_CHECK_CALL_SITE)
+		mvee_call_site_checks = 1;
+	mvee_shm_deferred_ops = mvee_shm_write_combining || mvee_shm_check_window;
+	mvee_shm_syscall_hook = mvee_hooks_enabled && mvee_shm_deferred_ops;
+
+	mvee_agent_setup();
+	mvee_thread_bootstrap();
+}
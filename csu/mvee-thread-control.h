@@ -0,0 +1,63 @@
+#ifndef _MVEE_THREAD_CONTROL_H
+#define _MVEE_THREAD_CONTROL_H
+
+//
+// Per-thread control block (MVEE_GET_THREAD_CONTROL).
+//
+// Every thread asks the MVEE for its control block once: new threads from
+// start_thread, the main thread from mvee_agent_init, and forked children on
+// their first replicated operation. The MVEE sets up the thread's buffers and
+// describes them all in the block, so the agents can attach them without a
+// fake syscall per buffer. The same call registers all of mvee_thread_state
+// for MVEE_RESET_ATFORK, so a forked child starts over with a fresh block.
+//
+// The agent fills in the fields up to master_thread_id, the MVEE the rest. A
+// buffer the MVEE left out has id -1, and the agent asks for that one with
+// MVEE_GET_SHARED_BUFFER as before. Monitors that don't know the call fail
+// it, and the agents then ask for every buffer separately.
+//
+// Keep the layout in sync with the MVEE. Bump the version if you change it.
+//
+#define MVEE_THREAD_CONTROL_VERSION  1
+
+enum mvee_thread_buffers
+{
+  MVEE_THREAD_ATOMIC_BUFFER = 0, // the WoC agent's queue (MVEE_LIBC_ATOMIC_BUFFER)
+  MVEE_THREAD_SHM_BUFFER    = 1, // the SHM agent's queue (MVEE_SHM_BUFFER)
+  MVEE_THREAD_BUFFERS
+};
+
+struct mvee_thread_buffer
+{
+  long          id;               // the shm id to attach, -1 if the MVEE didn't set it up
+  unsigned long size;             // in bytes
+};
+
+struct mvee_thread_control
+{
+  unsigned int              version;          // MVEE_THREAD_CONTROL_VERSION, 0 if we don't have a block
+  unsigned int              size;             // sizeof(struct mvee_thread_control)
+  void*                     clocks;           // the WoC agent's clocks, as passed to MVEE_GET_SHARED_BUFFER
+  unsigned long*            queue_pos;        // the WoC agent's position in its queue, idem
+  long                      master_thread_id; // the id of the matching thread in the leader
+  struct mvee_thread_buffer buffers[MVEE_THREAD_BUFFERS];
+};
+
+struct mvee_op_entry;
+
+//
+// The per-thread state the agents set up on first use. The MVEE clears all of
+// it in a forked child.
+//
+struct mvee_thread_state
+{
+  struct mvee_thread_control control;
+  struct mvee_op_entry*      atomic_queue;     // the WoC agent's queue
+  char*                      shm_buffer;       // the SHM agent's queue
+  unsigned int               master_thread_id; // total/partial agent only
+};
+
+extern __thread struct mvee_thread_state mvee_thread_state attribute_hidden;
+extern struct mvee_thread_control* mvee_get_thread_control(void) attribute_hidden;
+
+#endif /* _MVEE_THREAD_CONTROL_H */
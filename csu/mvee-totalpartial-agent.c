@@ -1,18 +1,38 @@
-static volatile unsigned int          mvee_lock_owner               = 0;
 static unsigned char                  mvee_buffer_valid             = 0;
-static unsigned short                 mvee_my_variant_num           = 0;
 static struct mvee_buffer_info*       mvee_lock_buffer_info         = NULL;
 static struct mvee_buffer_entry*      mvee_lock_buffer              = NULL;
+// this variant's tag map. One byte per entry in mvee_lock_buffer
+static unsigned char*                 mvee_tag_map                  = NULL;
 static struct mvee_callstack_entry*   mvee_callstack_buffer         = NULL;
-static __thread unsigned int          mvee_master_thread_id         = 0;
+// The id of our thread in the leader is in mvee_thread_state.master_thread_id
 static __thread unsigned long         mvee_prev_flush_cnt           = 0;
 static __thread unsigned long         mvee_lock_buffer_prev_pos     = 0;
-#ifdef MVEE_CHECK_LOCK_TYPE
-static __thread unsigned long         mvee_original_call_site       = 0;
-#define INLINEIFNODEBUG __attribute__((noinline))
-#else
-#define INLINEIFNODEBUG inline
+// master only: 1 + index of the slot we've reserved for the operation in progress
+static __thread unsigned int          mvee_master_pos               = 0;
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+// 1 + index of the last operation this thread logged (master) or replicated (slave)
+// in the current buffer. 0 if there is none
+static __thread unsigned int          mvee_lock_buffer_last_pos     = 0;
+// master only: the flush count at the time we logged that operation
+static __thread unsigned int          mvee_lock_buffer_last_flush_cnt = 0;
+// master only: (flush count << 32) | (1 + index of the last operation) per word hash bucket.
+// Updated with an atomic exchange so the operations on a bucket form a chain
+#define MVEE_WORD_TABLE_BITS 12
+static unsigned long                  mvee_word_last_pos[1 << MVEE_WORD_TABLE_BITS];
+// the thread head table in the lock buffer. Shared by all variants
+static unsigned int*                  mvee_thread_heads             = NULL;
 #endif
+// MVEE_CHECK_FULL only: return address of the outermost replicated operation in progress
+static __thread unsigned long         mvee_original_call_site       = 0;
+
+//
+// The helpers that do checks take the check level (glibc.mvee.check_level) as
+// their first argument, and are always inlined. The external APIs call them
+// with a constant MVEE_CHECK_OFF when the checks are off, so that copy of the
+// agent compiles to the same code as it would without any checks. All other
+// levels share a single out-of-line copy.
+//
+#define MVEE_AGENT_INLINE inline __attribute__((always_inline))
 
 // ========================================================================================================================
 // INITIALIZATION FUNCS
@@ -20,10 +40,19 @@ static __thread unsigned long         mvee_original_call_site       = 0;
 
 static void mvee_check_buffer(void)
 {
-	if (unlikely(!mvee_master_thread_id))
+	if (unlikely(!mvee_thread_state.master_thread_id))
     {
-		mvee_master_thread_id = syscall(MVEE_GET_MASTERTHREAD_ID);
-		syscall(MVEE_RESET_ATFORK, &mvee_master_thread_id, sizeof(mvee_master_thread_id));
+		struct mvee_thread_control* control = mvee_get_thread_control();
+
+		if (likely(control != NULL))
+		{
+			mvee_thread_state.master_thread_id = control->master_thread_id;
+		}
+		else
+		{
+			mvee_thread_state.master_thread_id = syscall(MVEE_GET_MASTERTHREAD_ID);
+			syscall(MVEE_RESET_ATFORK, &mvee_thread_state.master_thread_id, sizeof(mvee_thread_state.master_thread_id));
+		}
 
 		if (!mvee_buffer_valid)
 		{
@@ -39,35 +68,61 @@ static void mvee_check_buffer(void)
 			unsigned long slots = 0;
 			long tmp_id = syscall(MVEE_GET_SHARED_BUFFER, 0, queue_ident, &slots, sizeof(struct mvee_buffer_entry));
 
-			// we use some of the slots for buffer_info entries
-			slots       = (slots - mvee_num_variants * 64) / sizeof(struct mvee_buffer_entry) - 2;
+			// we use some of the space for buffer_info entries, the tag maps
+			// and the thread head table. Every entry costs one tag byte per
+			// variant. Another 64 bytes per variant cover the rounding of the
+			// tag maps.
+			slots       = (slots - mvee_num_variants * 128 - MVEE_THREAD_HEAD_BUCKETS * sizeof(unsigned int))
+				/ (sizeof(struct mvee_buffer_entry) + mvee_num_variants) - 2;
 			
 			// Attach to the buffer
 			void* tmp_buffer      = (void*)syscall(__NR_shmat, tmp_id, NULL, 0);
 			mvee_lock_buffer_info = ((struct mvee_buffer_info*) tmp_buffer) + mvee_my_variant_num;
 			mvee_lock_buffer      = ((struct mvee_buffer_entry*) tmp_buffer) + mvee_num_variants;
+			mvee_tag_map          = (unsigned char*) (mvee_lock_buffer + slots + 2) +
+				mvee_my_variant_num * ((slots + 2 + 63) & ~63ul);
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+			mvee_thread_heads     = (unsigned int*) ((unsigned char*) (mvee_lock_buffer + slots + 2) +
+				mvee_num_variants * ((slots + 2 + 63) & ~63ul));
+#endif
 			mvee_lock_buffer_info->lock = 1;			
 			mvee_lock_buffer_info->size = slots;
 			mvee_lock_buffer_info->buffer_type = queue_ident;
 
-#ifdef MVEE_LOG_EIPS			
-			long callstack_buffer_id = syscall(MVEE_GET_SHARED_BUFFER, 1, queue_ident, NULL,
-											   mvee_num_variants * sizeof(struct mvee_callstack_entry),
-											   MVEE_STACK_DEPTH);
-			mvee_callstack_buffer = (struct mvee_callstack_entry*) syscall(__NR_shmat, callstack_buffer_id, NULL, 0);
-#endif
+			if (mvee_check_level >= MVEE_CHECK_FULL)
+			{
+				long callstack_buffer_id = syscall(MVEE_GET_SHARED_BUFFER, 1, queue_ident, NULL,
+												   mvee_num_variants * sizeof(struct mvee_callstack_entry),
+												   MVEE_STACK_DEPTH);
+				mvee_callstack_buffer = (struct mvee_callstack_entry*) syscall(__NR_shmat, callstack_buffer_id, NULL, 0);
+			}
 		}
     }
 }
 
 
-static INLINEIFNODEBUG int mvee_should_sync(void)
+// Nothing to set up eagerly. The buffers are attached in mvee_check_buffer.
+static void mvee_agent_setup(void)
+{
+}
+
+// Our lock buffer is shared by all threads, so the MVEE needn't set up anything
+static inline void mvee_agent_describe_thread(struct mvee_thread_control* control)
+{
+}
+
+// Picks up the calling thread's master thread id before its first operation (mvee_thread_bootstrap)
+static void mvee_agent_attach_thread(void)
+{
+	if (mvee_sync_enabled)
+		mvee_check_buffer();
+}
+
+static inline int mvee_should_sync(void)
 {
 	if (unlikely(!mvee_libc_initialized))
 	{
-		long res = syscall(MVEE_RUNS_UNDER_MVEE_CONTROL, &mvee_sync_enabled, &mvee_infinite_loop, 
-						   &mvee_num_variants, &mvee_my_variant_num, &mvee_master_variant, &mvee_shm_tag);
-		if (!(res < 0 && res > -4095))
+		if (mvee_detect_monitor())
 			mvee_check_buffer();
 		mvee_libc_initialized = 1;
 	}
@@ -76,6 +131,13 @@ static INLINEIFNODEBUG int mvee_should_sync(void)
 
 #define cpu_relax() asm volatile("rep; nop" ::: "memory")
 
+// Yields while we wait for the master or for other slave threads
+static inline void mvee_yield(void)
+{
+	mvee_stats_count_backoff(1, MVEE_STATS_YIELD);
+	syscall(__NR_sched_yield);
+}
+
 /*
  * logs a (truncated) stack into the specified "eip" buffer. This stack is logged for EVERY variant,
  * which greatly facilitates debugging. The MVEE can dump the contents of this buffer very efficiently, 
@@ -87,7 +149,10 @@ static INLINEIFNODEBUG int mvee_should_sync(void)
  */
 static void __attribute__ ((noinline)) mvee_log_stack(unsigned int pos, int start_depth)
 {
-#ifdef MVEE_LOG_EIPS
+	// We only have a callstack buffer at MVEE_CHECK_FULL
+	if (!mvee_callstack_buffer)
+		return;
+
 	int entries_logged = 0;
 	int next_entry = start_depth;
 
@@ -107,13 +172,9 @@ static void __attribute__ ((noinline)) mvee_log_stack(unsigned int pos, int star
 			DEF_CASE(0);
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wframe-address"
-#ifdef MVEE_CHECK_LOCK_TYPE
 			case 1:
 				ret_addr = (unsigned long)mvee_original_call_site;
 				break;
-#else
-			DEF_CASE(1);
-#endif
 
 			DEF_CASE(2);
 			DEF_CASE(3);
@@ -130,40 +191,35 @@ static void __attribute__ ((noinline)) mvee_log_stack(unsigned int pos, int star
 		mvee_callstack_buffer[pos * mvee_num_variants + mvee_my_variant_num].callee[entries_logged++] = ret_addr;
 		next_entry++;
     }
-#endif
 }
 
 // ========================================================================================================================
 // ASSERTIONS
 // ========================================================================================================================
 
-static INLINEIFNODEBUG void mvee_assert_lock_not_owned(void)
+static MVEE_AGENT_INLINE void mvee_assert_no_slot_reserved(unsigned char check_level)
 {
-#ifdef MVEE_CHECK_LOCK_TYPE
-	if (mvee_lock_owner)
-		*(volatile long*)0 = mvee_lock_owner;
-#endif
+	if (check_level >= MVEE_CHECK_FULL && mvee_master_pos)
+		*(volatile long*)0 = mvee_master_pos;
 }
 
-static INLINEIFNODEBUG void mvee_assert_lock_owned(void)
+static MVEE_AGENT_INLINE void mvee_assert_slot_reserved(unsigned char check_level)
 {
-#ifdef MVEE_CHECK_LOCK_TYPE
-	if (!mvee_lock_owner || 
-		mvee_lock_owner != mvee_master_thread_id)
-	{
-		*(volatile long*)0 = mvee_lock_owner;
-	}
-#endif
+	if (check_level >= MVEE_CHECK_FULL && !mvee_master_pos)
+		*(volatile long*)0 = mvee_thread_state.master_thread_id;
 }
 
-static INLINEIFNODEBUG void mvee_assert_operation_matches
+static MVEE_AGENT_INLINE void mvee_assert_operation_matches
 (
+	unsigned char check_level,
 	unsigned int pos, 
 	unsigned long slave_word_ptr, 
 	unsigned short slave_op_type
 )
 {
-#ifdef MVEE_CHECK_LOCK_TYPE
+	if (check_level < MVEE_CHECK_OP_TYPE)
+		return;
+
 	unsigned long master_word_ptr = mvee_lock_buffer[pos].word_ptr;
 	unsigned short master_op_type = mvee_lock_buffer[pos].operation_type;
 
@@ -179,113 +235,227 @@ static INLINEIFNODEBUG void mvee_assert_operation_matches
 		syscall(__NR_gettid, 1337, 10000001, 60, 0, pos);
 		syscall(__NR_gettid, 1337, 10000001, 59, master_op_type, slave_op_type);
 	}
-#endif
 }
 
-static INLINEIFNODEBUG void mvee_assert_at_end_of_buffer(unsigned int pos)
+static inline void mvee_assert_at_end_of_buffer(unsigned int pos)
 {
 	if (pos != mvee_lock_buffer_info->size)
 		*(volatile int*) 0 = 0x0bad1dea;
 }
 
-static INLINEIFNODEBUG void mvee_assert_same_callee(unsigned int pos)
+static inline void mvee_assert_same_call_site(unsigned int pos, unsigned int call_site)
+{
+	if (unlikely(mvee_lock_buffer[pos].call_site != call_site))
+		mvee_call_site_mismatch(mvee_lock_buffer[pos].operation_type, mvee_lock_buffer[pos].call_site, call_site);
+}
+
+static MVEE_AGENT_INLINE void mvee_assert_same_callee(unsigned char check_level, unsigned int pos)
 {
-// check call site, should be ASLR proof
-#if defined(MVEE_CHECK_LOCK_TYPE) && defined(MVEE_LOG_EIPS)
+	if (check_level < MVEE_CHECK_FULL || !mvee_callstack_buffer)
+		return;
+
+	// check call site, should be ASLR proof
 	unsigned long parent_eip = mvee_callstack_buffer[pos * mvee_num_variants + mvee_my_variant_num].callee[0];
 	unsigned long our_eip = (unsigned long)mvee_original_call_site;
 
 	if ((parent_eip & 0xfff) != (our_eip & 0xfff))
 		syscall(__NR_gettid, 1337, 10000001, 90, mvee_lock_buffer[pos].operation_type, parent_eip, our_eip);
-#endif
 }
 
 // ========================================================================================================================
 // MASTER LOGIC
 // ========================================================================================================================
 
-static INLINEIFNODEBUG unsigned int mvee_write_lock_result_prepare(void)
+//
+// glibc.mvee.ring_buffers doesn't apply to the lock buffer. The slaves find
+// their operations through positions, flush counts and tags that are only
+// valid until the next flush, so a full buffer is always flushed.
+//
+static inline void mvee_lock_buffer_flush(void)
 {
-	while (1)
-    {
-		if (orig_atomic_decrement_and_test(&mvee_lock_buffer_info->lock))
-		{
-			mvee_assert_lock_not_owned();
-			mvee_lock_owner = mvee_master_thread_id;
-			return mvee_lock_buffer_info->pos;
-		}
-      
-		while (mvee_lock_buffer_info->lock <= 0)
-			cpu_relax();
-    }
+	mvee_lock_buffer_info->flushing = 1;
+	atomic_full_barrier();
 
-	// unreachable
-	return mvee_lock_buffer_info->pos;
+	mvee_stats_count_flushes();
+	syscall(MVEE_FLUSH_SHARED_BUFFER, mvee_lock_buffer_info->buffer_type);
+
+	// Don't just bump our own copy of the flush count. In the master, it isn't
+	// kept up to date, and the flush count must never repeat.
+	// The new flush count must be visible before pos is reset. A master thread
+	// that reserves a slot in the new buffer reads the flush count afterwards.
+	mvee_lock_buffer_info->flush_cnt = mvee_prev_flush_cnt = mvee_lock_buffer_info->flush_cnt + 1;
+	atomic_full_barrier();
+
+	mvee_lock_buffer_info->pos = 0;
+	atomic_full_barrier();
+	mvee_lock_buffer_info->flushing = 0;
 }
 
-static INLINEIFNODEBUG void mvee_write_lock_result_finish(void)
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+//
+// Returns 1 + the index of the previous operation on the same hash bucket as
+// word_ptr in the current buffer, or 0 if there is none, and records pos as the
+// new last operation on that bucket. A slave only has to wait for that one
+// operation: it can't have been replicated before everything that precedes it
+// on the same bucket.
+//
+static inline unsigned int mvee_word_predecessor(void* word_ptr, unsigned int pos)
 {
-	mvee_assert_lock_owned();
-	mvee_lock_owner = 0;
-	orig_atomic_increment(&mvee_lock_buffer_info->pos);
-	mvee_lock_buffer_info->lock = 1;
+	unsigned long* bucket = &mvee_word_last_pos[((unsigned long)word_ptr * 0x9E3779B97F4A7C15ul) >> (64 - MVEE_WORD_TABLE_BITS)];
+	unsigned long flush_cnt = mvee_lock_buffer_info->flush_cnt;
+	unsigned long prev = orig_atomic_exchange_acq(bucket, (flush_cnt << 32) | (pos + 1));
+
+	return ((prev >> 32) == flush_cnt) ? (unsigned int) prev : 0;
 }
 
-static INLINEIFNODEBUG void mvee_lock_buffer_flush(void)
+static inline unsigned int* mvee_thread_head(unsigned int master_thread_id)
 {
-	mvee_lock_buffer_info->flushing = 1;
-	atomic_full_barrier();
+	return &mvee_thread_heads[(master_thread_id * 0x9E3779B9u) >> (32 - MVEE_THREAD_HEAD_BITS)];
+}
 
-	syscall(MVEE_FLUSH_SHARED_BUFFER, mvee_lock_buffer_info->buffer_type);
-	mvee_lock_buffer_info->pos = 0;
-	atomic_full_barrier();
+//
+// Links the previous operation by this thread to the one at pos, so the slave
+// thread can jump straight to it instead of scanning the buffer. The first
+// operation in the buffer goes into the thread head table instead.
+//
+static inline void mvee_link_thread_op(unsigned int pos)
+{
+	if (mvee_lock_buffer_last_pos && mvee_lock_buffer_last_flush_cnt == mvee_lock_buffer_info->flush_cnt)
+	{
+		orig_atomic_store_release(&mvee_lock_buffer[mvee_lock_buffer_last_pos - 1].next_pos, pos);
+	}
+	else
+	{
+		// Threads that share a bucket race for it. Keep the earliest operation
+		unsigned int* head = mvee_thread_head(mvee_thread_state.master_thread_id);
+		unsigned int old = orig_atomic_load_acquire(head);
 
-	mvee_lock_buffer_info->flush_cnt = (++mvee_prev_flush_cnt);
-	mvee_lock_buffer_info->flushing = 0;
+		while ((!old || old > pos + 1) &&
+			   orig_atomic_compare_and_exchange_bool_acq(head, pos + 1, old))
+			old = orig_atomic_load_acquire(head);
+	}
+
+	mvee_lock_buffer_last_pos = pos + 1;
+	mvee_lock_buffer_last_flush_cnt = mvee_lock_buffer_info->flush_cnt;
 }
+#endif
 
-static INLINEIFNODEBUG void mvee_write_lock_result_write(unsigned int pos, unsigned short op_type, void* word_ptr)
+//
+// Wait until the master operation in slot pos has completed
+//
+static inline void mvee_wait_for_master_op(unsigned int pos)
 {
+	unsigned int waited = 0;
+
+	while (!orig_atomic_load_acquire(&mvee_tag_map[pos]))
+	{
+		mvee_stats_count_backoff(waited++, MVEE_STATS_SPIN);
+		cpu_relax();
+	}
+
+	mvee_stats_wait_end(waited);
+}
+
+//
+// Reserves a slot in the buffer. Master threads only contend on the pos
+// field. The thread that draws the index right past the end of the buffer
+// logs the end-of-buffer marker and flushes. Threads that draw an index beyond
+// that just wait for the flush to complete and try again.
+//
+static MVEE_AGENT_INLINE unsigned int mvee_write_lock_result_prepare(unsigned char check_level)
+{
+	mvee_assert_no_slot_reserved(check_level);
+
 	while (1)
 	{
+		unsigned int pos = orig_atomic_exchange_and_add(&mvee_lock_buffer_info->pos, 1);
+
 		if (likely(pos < mvee_lock_buffer_info->size))
 		{
-			mvee_lock_buffer[pos].word_ptr = (unsigned long) word_ptr;
-			mvee_lock_buffer[pos].operation_type = op_type;
-
-#ifdef MVEE_CHECK_LOCK_TYPE
-			if (mvee_lock_owner != mvee_master_thread_id)
-				*(volatile long*)0 = mvee_lock_owner;
-#endif
+			mvee_master_pos = pos + 1;
+			return pos;
+		}
 
-			mvee_log_stack(pos, 1);
+		if (pos == mvee_lock_buffer_info->size)
+		{
+			// every slot in the buffer has been reserved. Wait for their
+			// operations to complete so nobody writes into the buffer
+			// while the MVEE is flushing it
+			for (unsigned int i = 0; i < pos; ++i)
+				mvee_wait_for_master_op(i);
 
-			// This must be stored last. The slave assumes that when
-			// master_thread_id becomes non-zero, the word_ptr and operation_type
-			// fields are valid too
-			mvee_lock_buffer[pos].master_thread_id = mvee_master_thread_id;
-			break;
-		}
-		else
-		{      
 			// we log the tid of the flushing thread into the last slot
-			mvee_lock_buffer[pos].master_thread_id = mvee_master_thread_id;
+			mvee_lock_buffer[pos].master_thread_id = mvee_thread_state.master_thread_id;
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+			mvee_link_thread_op(pos);
+#endif
 			mvee_lock_buffer_flush();
-			pos = 0;
+		}
+		else
+		{
+			while (mvee_lock_buffer_info->pos >= mvee_lock_buffer_info->size)
+				cpu_relax();
 		}
 	}
+
+	// unreachable
+	return 0;
+}
+
+static MVEE_AGENT_INLINE void mvee_write_lock_result_write(unsigned char check_level, unsigned int pos, unsigned short op_type, void* word_ptr, unsigned int call_site)
+{
+	unsigned int wait_pos;
+
+	mvee_assert_slot_reserved(check_level);
+
+	mvee_lock_buffer[pos].word_ptr = (unsigned long) word_ptr;
+	mvee_lock_buffer[pos].operation_type = op_type;
+	// This is in the cache line we're writing anyway, so we always log it
+	mvee_lock_buffer[pos].call_site = call_site;
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+	// we only have to wait for the previous operation on this location
+	wait_pos = mvee_lock_buffer[pos].prev_word_pos = mvee_word_predecessor(word_ptr, pos);
+#else
+	// we have to wait for the previous operation in the buffer
+	wait_pos = pos;
+#endif
+
+	if (check_level >= MVEE_CHECK_FULL)
+		mvee_log_stack(pos, 1);
+
+	// This must be stored last. The slave assumes that when
+	// master_thread_id becomes non-zero, the word_ptr and operation_type
+	// fields are valid too
+	orig_atomic_store_release(&mvee_lock_buffer[pos].master_thread_id, mvee_thread_state.master_thread_id);
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+	mvee_link_thread_op(pos);
+#endif
+
+	// Slots can be published out of order, but the operations themselves
+	// must execute in the order we've logged
+	if (wait_pos)
+		mvee_wait_for_master_op(wait_pos - 1);
+}
+
+static MVEE_AGENT_INLINE void mvee_write_lock_result_finish(unsigned char check_level)
+{
+	mvee_assert_slot_reserved(check_level);
+
+	// tag our slot. This lets the operations that are waiting for ours go ahead
+	orig_atomic_store_release(&mvee_tag_map[mvee_master_pos - 1], 1);
+	mvee_master_pos = 0;
 }
 
 // ========================================================================================================================
 // SLAVE LOGIC
 // ========================================================================================================================
 
-static INLINEIFNODEBUG unsigned char mvee_op_is_tagged(unsigned long pos)
+static inline unsigned char mvee_op_is_tagged(unsigned long pos)
 {
-	return mvee_lock_buffer[pos].tags[mvee_my_variant_num];
+	return mvee_tag_map[pos];
 }
 
-static INLINEIFNODEBUG unsigned char mvee_pos_still_valid(void)
+static inline unsigned char mvee_pos_still_valid(void)
 {
 	if (mvee_lock_buffer_info->flushing || 
 		mvee_lock_buffer_info->flush_cnt != mvee_prev_flush_cnt)
@@ -301,7 +471,7 @@ static INLINEIFNODEBUG unsigned char mvee_pos_still_valid(void)
 // if @wait_for_all_ops == 0, this waits until all operations on the same 
 // current_word_ptr get tagged
 //
-static INLINEIFNODEBUG void mvee_wait_for_preceding_ops
+static inline void mvee_wait_for_preceding_ops
 (
 	unsigned int start_pos, 
 	unsigned int end_pos, 
@@ -335,11 +505,11 @@ static INLINEIFNODEBUG void mvee_wait_for_preceding_ops
 			break;
 		}
 		
-		syscall(__NR_sched_yield);
+		mvee_yield();
 	}
 }
 
-static INLINEIFNODEBUG void mvee_read_lock_result_wait(unsigned short op_type, void* word_ptr)
+static MVEE_AGENT_INLINE void mvee_read_lock_result_wait(unsigned char check_level, unsigned short op_type, void* word_ptr)
 {
 #ifdef MVEE_PARTIAL_ORDER_REPLICATION
 	unsigned long master_word_ptr;
@@ -360,6 +530,12 @@ static INLINEIFNODEBUG void mvee_read_lock_result_wait(unsigned short op_type, v
 		// operation on address &A, then we know that address &A in the master
 		// is equivalent to address <word_ptr> in the slave.
 		//
+		// Links: once we've replicated an operation in the current buffer, the
+		// master links it to the next operation by the same thread, so we can
+		// jump straight to it. For the first operation in a buffer, the thread
+		// head table tells us where our master thread's operations start. We
+		// only have to scan from there if another thread shares the bucket.
+		//
 		// Caching: We start the search one item beyond the previously
 		// replicated operation by this thread. The index of the previously
 		// replicated operation is stored in mvee_lock_buffer_prev_pos.  It
@@ -374,79 +550,110 @@ static INLINEIFNODEBUG void mvee_read_lock_result_wait(unsigned short op_type, v
 			// position of our previously replicated operation
 			mvee_prev_flush_cnt = mvee_lock_buffer_info->flush_cnt;
 			mvee_lock_buffer_prev_pos = start_pos = 0;
-			syscall(__NR_sched_yield);
+			mvee_lock_buffer_last_pos = 0;
+			mvee_yield();
 		}
 
+		unsigned char found = 0;
 		master_word_ptr = 0;
 
-		for (current_pos = start_pos; current_pos <= mvee_lock_buffer_info->size; ++current_pos)
+		if (likely(mvee_lock_buffer_last_pos))
 		{
-			unsigned int tid = mvee_lock_buffer[current_pos].master_thread_id;
+			current_pos = orig_atomic_load_acquire(&mvee_lock_buffer[mvee_lock_buffer_last_pos - 1].next_pos);
 
-			// no tid => the slaves are running ahead of the master
-			// or the master stores are not visible yet
-			if (!tid)
+			if (current_pos)
 			{
-				break;
+				// if the link is visible, then the entry will be too
+				master_word_ptr = mvee_lock_buffer[current_pos].word_ptr;
+
+				// make sure that the link didn't come from the next buffer
+				found = mvee_pos_still_valid();
 			}
-			else if (tid != mvee_master_thread_id || 
-					 mvee_op_is_tagged(current_pos))
+		}
+		else
+		{
+			unsigned int head = orig_atomic_load_acquire(mvee_thread_head(mvee_thread_state.master_thread_id));
+
+			// no head => the master hasn't logged anything for our bucket yet
+			if (!head)
 			{
-				continue;
+				current_pos = start_pos;
 			}
-
-			// if tid is visible, then this will be too
-			master_word_ptr = mvee_lock_buffer[current_pos].word_ptr;
-
-			if (mvee_pos_still_valid())
-			{				
-				// this will only happen if we're at the end of the queue
-				// at which point we log a pseudo-operation with master_word_ptr == 0
-				if (!master_word_ptr)
+			else
+			{
+				for (current_pos = head - 1 > start_pos ? head - 1 : start_pos; current_pos <= mvee_lock_buffer_info->size; ++current_pos)
 				{
-					// assert that we're at the end of the buffer			   
-					mvee_assert_at_end_of_buffer(current_pos);
-					// wait for everything before us to complete
-					mvee_wait_for_preceding_ops(start_pos, mvee_lock_buffer_info->size, 1, 0);
-					mvee_lock_buffer_flush();
-					current_pos = mvee_lock_buffer_prev_pos = 0;
-					break;
-				}
-				else
-				{					
-					// We found a non-replicated operation for our thread at position
-					// <current_pos>. If the buffer has not been flushed between the moment
+					unsigned int tid = mvee_lock_buffer[current_pos].master_thread_id;
+
+					// no tid => the slaves are running ahead of the master
+					// or the master stores are not visible yet
+					if (!tid)
+					{
+						break;
+					}
+					else if (tid != mvee_thread_state.master_thread_id || 
+							 mvee_op_is_tagged(current_pos))
+					{
+						continue;
+					}
+
+					// if tid is visible, then this will be too
+					master_word_ptr = mvee_lock_buffer[current_pos].word_ptr;
+
+					// If the buffer has not been flushed between the moment
 					// we determined the start position of our search and the moment
 					// we found the non-replicated operation, we can now safely assume that
-					// it is not going to be flushed.
-					mvee_assert_operation_matches(current_pos, (unsigned long) word_ptr, op_type);
+					// it is not going to be flushed. Otherwise, some other thread
+					// flushed the buffer while we were searching.
+					found = mvee_pos_still_valid();
+					if (!found)
+						current_pos = 0;
 					break;
 				}
 			}
-			else
+		}
+
+		if (found)
+		{
+			// this will only happen if we're at the end of the queue
+			// at which point we log a pseudo-operation with master_word_ptr == 0
+			if (!master_word_ptr)
 			{
-				// Some other thread flushed the buffer while we were searching for the
-				// next non-replicated position.
-				master_word_ptr = 0;
-				current_pos = 0;
-				break;
+				// assert that we're at the end of the buffer			   
+				mvee_assert_at_end_of_buffer(current_pos);
+				// wait for everything in the buffer to complete. We might not
+				// have scanned the buffer at all, so start from the beginning
+				mvee_wait_for_preceding_ops(0, mvee_lock_buffer_info->size, 1, 0);
+				mvee_lock_buffer_flush();
+				start_pos = mvee_lock_buffer_prev_pos = 0;
+				mvee_lock_buffer_last_pos = 0;
+				continue;
 			}
-		}
 
-		if (master_word_ptr)
+			mvee_assert_operation_matches(check_level, current_pos, (unsigned long) word_ptr, op_type);
 			break;
+		}
 
 		// if we get to this point, it means that the slave 
 		// has caught up with the master
 		// => we restart the iteration but this time
 		// we start at the position we were at
-		start_pos = current_pos;
-		syscall(__NR_sched_yield);
+		if (!mvee_lock_buffer_last_pos)
+			start_pos = current_pos;
+		mvee_yield();
 	}
 
-	// STEP 2: FIND PRECEDING OPERATIONS ON THIS LOCATION
-	mvee_wait_for_preceding_ops(mvee_lock_buffer_info->pos, current_pos, 0, master_word_ptr);
-	mvee_log_stack(current_pos, 1);
+	// STEP 2: WAIT FOR THE PRECEDING OPERATION ON THIS LOCATION
+	// Once that one has been tagged, all earlier operations on
+	// this location have been tagged too.
+	unsigned int prev_word_pos = mvee_lock_buffer[current_pos].prev_word_pos;
+	if (prev_word_pos)
+		while (!mvee_op_is_tagged(prev_word_pos - 1))
+			mvee_yield();
+
+	mvee_lock_buffer_prev_pos = current_pos;
+	if (check_level >= MVEE_CHECK_FULL)
+		mvee_log_stack(current_pos, 1);
 
 #else // MVEE_TOTAL_ORDER_REPLICATION
 
@@ -458,30 +665,31 @@ static INLINEIFNODEBUG void mvee_read_lock_result_wait(unsigned short op_type, v
       
 		if (current_pos < mvee_lock_buffer_info->size)
 		{
-			if (mvee_lock_buffer[current_pos].master_thread_id == mvee_master_thread_id)
+			if (mvee_lock_buffer[current_pos].master_thread_id == mvee_thread_state.master_thread_id)
 			{
-				mvee_assert_operation_matches(current_pos, (unsigned long)word_ptr, op_type);
-				mvee_log_stack(current_pos, 1);
+				mvee_assert_operation_matches(check_level, current_pos, (unsigned long)word_ptr, op_type);
+				if (check_level >= MVEE_CHECK_FULL)
+					mvee_log_stack(current_pos, 1);
 				break;
 			}
 
-			syscall(__NR_sched_yield);
+			mvee_yield();
 		}
 		else
 		{
 			unsigned int tid = mvee_lock_buffer[current_pos].master_thread_id;
 
 			// we have to flush... figure out which thread does the flush
-			if (tid == mvee_master_thread_id)
+			if (tid == mvee_thread_state.master_thread_id)
 			{
 				mvee_lock_buffer_flush();
 			}
 			else
 			{
 				while (mvee_lock_buffer_info->pos == mvee_lock_buffer_info->size &&
-					   mvee_lock_buffer[current_pos].master_thread_id != mvee_master_thread_id)
+					   mvee_lock_buffer[current_pos].master_thread_id != mvee_thread_state.master_thread_id)
 				{
-					syscall(__NR_sched_yield);
+					mvee_yield();
 				}
 			}
 		}
@@ -490,32 +698,38 @@ static INLINEIFNODEBUG void mvee_read_lock_result_wait(unsigned short op_type, v
 #endif
 }
 
-static INLINEIFNODEBUG void mvee_read_lock_result_wake(void)
+static MVEE_AGENT_INLINE void mvee_read_lock_result_wake(unsigned char check_level)
 {
 #ifdef MVEE_PARTIAL_ORDER_REPLICATION
-	mvee_assert_same_callee(mvee_lock_buffer_prev_pos);
+	mvee_assert_same_callee(check_level, mvee_lock_buffer_prev_pos);
 #else
-	mvee_assert_same_callee(mvee_lock_buffer_info->pos);
+	mvee_assert_same_callee(check_level, mvee_lock_buffer_info->pos);
 #endif
 
 #ifdef MVEE_PARTIAL_ORDER_REPLICATION
-	
-	// Check if we can increase the pos so other threads get a smaller scan window
-	// Don't try to move beyond prev_pos. Otherwise, the buffer might get flushed while
-	// we're tagging our completed operation
-	for (unsigned int i = mvee_lock_buffer_info->pos; i < mvee_lock_buffer_prev_pos; ++i)
-    {
-		if (!mvee_op_is_tagged(i))
-		{
-			orig_atomic_max(&mvee_lock_buffer_info->pos, i);
-			break;
-		}
+
+	// tag this slot. The tag must be visible before we look at pos: either we
+	// see that pos reached our slot, or the thread that moves it there sees
+	// our tag.
+	mvee_tag_map[mvee_lock_buffer_prev_pos] = 1;
+	atomic_full_barrier();
+
+	// Move pos over the operations that have been replicated, so other threads
+	// get a smaller scan window. pos only moves forward, and we stop at the
+	// first operation that hasn't been replicated yet. Whoever completes that
+	// one carries on from there, so every slot is skipped once per buffer
+	// rather than walked by every thread.
+	unsigned int pos = mvee_lock_buffer_info->pos;
+	while (pos < mvee_lock_buffer_info->size && mvee_op_is_tagged(pos))
+	{
+		if (!orig_atomic_compare_and_exchange_bool_acq(&mvee_lock_buffer_info->pos, pos + 1, pos))
+			pos++;
+		else
+			pos = mvee_lock_buffer_info->pos;
 	}
-  
-	// tag this slot
-	mvee_lock_buffer[mvee_lock_buffer_prev_pos].tags[mvee_my_variant_num] = 1;
 	
 	// make sure that our thread starts from prev_pos + 1 next time
+	mvee_lock_buffer_last_pos = mvee_lock_buffer_prev_pos + 1;
 	mvee_lock_buffer_prev_pos++;
 
 #else // MVEE_TOTAL_ORDER_REPLICATION
@@ -529,49 +743,92 @@ static INLINEIFNODEBUG void mvee_read_lock_result_wake(void)
 // EXTERNAL APIS
 // ========================================================================================================================
 
-unsigned char mvee_atomic_preop_internal(unsigned short op_type, void* word_ptr)
+//
+// @word_ptr isn't necessarily a pointer if @check_private is 0. mvee_xcheck
+// logs arbitrary values.
+//
+static MVEE_AGENT_INLINE unsigned char mvee_atomic_preop_common(unsigned char check_level, unsigned short op_type, void* word_ptr, unsigned int call_site, unsigned char check_private)
 {
+	mvee_stats_count_preop(op_type);
+
+	// SHM stores and checks we've held back must not move past this operation
+	if (unlikely(mvee_shm_deferred_ops))
+		mvee_shm_complete_deferred_ops();
+
     /* Tagged pointer => SHM */
 	if (unlikely((unsigned long long) word_ptr & 0x8000000000000000ull))
 		word_ptr = mvee_shm_decode_address(word_ptr);
 	else if (unlikely(!mvee_should_sync()))
 		return 0;
+	else if (check_private && mvee_word_is_private(word_ptr))
+		return 0;
 
 	mvee_check_buffer();
-#ifdef MVEE_CHECK_LOCK_TYPE
-	if (!mvee_original_call_site)
-		mvee_original_call_site = (unsigned long)__builtin_return_address(0);
-#endif
 	if (likely(mvee_master_variant))
     {
-		unsigned int pos = mvee_write_lock_result_prepare();
-		mvee_write_lock_result_write(pos, op_type, word_ptr);
+		unsigned int pos = mvee_write_lock_result_prepare(check_level);
+		mvee_write_lock_result_write(check_level, pos, op_type, word_ptr, call_site);
 		return 1;
     }
 	else
     {
-		mvee_read_lock_result_wait(op_type, word_ptr);
+		// We time every wait here. Most of them yield at some point.
+		mvee_stats_wait_begin();
+		mvee_read_lock_result_wait(check_level, op_type, word_ptr);
+		mvee_stats_wait_end(1);
+		if (unlikely(mvee_should_check_call_site()))
+#ifdef MVEE_PARTIAL_ORDER_REPLICATION
+			mvee_assert_same_call_site(mvee_lock_buffer_prev_pos, call_site);
+#else
+			mvee_assert_same_call_site(mvee_lock_buffer_info->pos, call_site);
+#endif
 		return 2;
     }
 }
 
-void mvee_atomic_postop_internal(unsigned char preop_result)
+static MVEE_AGENT_INLINE void mvee_atomic_postop_common(unsigned char check_level, unsigned char preop_result)
 {
 	if(likely(preop_result == 1))
-		mvee_write_lock_result_finish();
+		mvee_write_lock_result_finish(check_level);
 	else if (likely(preop_result == 2))
-		mvee_read_lock_result_wake();
-#ifdef MVEE_CHECK_LOCK_TYPE
+		mvee_read_lock_result_wake(check_level);
+}
+
+// The copies of the agent for all check levels other than MVEE_CHECK_OFF
+static unsigned char __attribute__((noinline)) mvee_atomic_preop_checked(unsigned short op_type, void* word_ptr, unsigned int call_site, unsigned char check_private)
+{
+	return mvee_atomic_preop_common(mvee_check_level, op_type, word_ptr, call_site, check_private);
+}
+
+static void __attribute__((noinline)) mvee_atomic_postop_checked(unsigned char preop_result)
+{
+	mvee_atomic_postop_common(mvee_check_level, preop_result);
 	mvee_original_call_site = 0;
-#endif   
+}
+
+unsigned char mvee_atomic_preop_internal(unsigned short op_type, void* word_ptr, unsigned int call_site)
+{
+	if (likely(mvee_check_level == MVEE_CHECK_OFF))
+		return mvee_atomic_preop_common(MVEE_CHECK_OFF, op_type, word_ptr, call_site, 1);
+
+	if (!mvee_original_call_site)
+		mvee_original_call_site = (unsigned long)__builtin_return_address(0);
+	return mvee_atomic_preop_checked(op_type, word_ptr, call_site, 1);
+}
+
+void mvee_atomic_postop_internal(unsigned char preop_result)
+{
+	if (likely(mvee_check_level == MVEE_CHECK_OFF))
+		mvee_atomic_postop_common(MVEE_CHECK_OFF, preop_result);
+	else
+		mvee_atomic_postop_checked(preop_result);
 }
 
 unsigned char mvee_atomic_preop(unsigned short op_type, void* word_ptr)
 {
-#ifdef MVEE_CHECK_LOCK_TYPE
-	mvee_original_call_site = (unsigned long)__builtin_return_address(0);
-#endif
-	return mvee_atomic_preop_internal(op_type + __MVEE_BASE_ATOMICS_MAX__, word_ptr);
+	if (unlikely(mvee_check_level != MVEE_CHECK_OFF))
+		mvee_original_call_site = (unsigned long)__builtin_return_address(0);
+	return mvee_atomic_preop_internal(op_type + __MVEE_BASE_ATOMICS_MAX__, word_ptr, MVEE_EXTERNAL_CALL_SITE());
 }
 
 void mvee_atomic_postop(unsigned char preop_result)
@@ -581,7 +838,18 @@ void mvee_atomic_postop(unsigned char preop_result)
 
 void mvee_xcheck(unsigned long item)
 {
-	unsigned char tmp = mvee_atomic_preop_internal(ATOMIC_STORE, (void*) item);
+	unsigned char tmp;
+
+	if (likely(mvee_check_level == MVEE_CHECK_OFF))
+	{
+		tmp = mvee_atomic_preop_common(MVEE_CHECK_OFF, ATOMIC_STORE, (void*) item, MVEE_EXTERNAL_CALL_SITE(), 0);
+	}
+	else
+	{
+		if (!mvee_original_call_site)
+			mvee_original_call_site = (unsigned long)__builtin_return_address(0);
+		tmp = mvee_atomic_preop_checked(ATOMIC_STORE, (void*) item, MVEE_EXTERNAL_CALL_SITE(), 0);
+	}
 	mvee_atomic_postop_internal(tmp);
 }
 
@@ -595,7 +863,8 @@ int mvee_should_sync_tid(void)
 void mvee_invalidate_buffer(void)
 {
 	mvee_buffer_valid = 0;
-	mvee_master_thread_id = 0;
+	mvee_thread_state.master_thread_id = 0;
+	mvee_thread_state.control.version = 0;
 }
 
 /* MVEE PATCH:
@@ -612,7 +881,7 @@ mvee_all_heaps_aligned(char* heap, unsigned long alloc_size)
 {
   // if we're not running under MVEE control,
   // just check the alignment of the current heap
-  if (!mvee_master_thread_id)
+  if (!mvee_thread_state.master_thread_id)
   {
       if ((unsigned long)heap & (ALIGNMENT-1))
 		  return 0;
@@ -1,14 +1,37 @@
 #include <mmap_internal.h>
-
-#define MVEE_TOTAL_CLOCK_COUNT   2048
-#define MVEE_CLOCK_GROUP_SIZE    64
-#define MVEE_TOTAL_CLOCK_GROUPS  (MVEE_TOTAL_CLOCK_COUNT / MVEE_CLOCK_GROUP_SIZE)
-
+#include <limits.h>
+#include <lowlevellock-futex.h>
+#include <sys/mman.h>
+#include "mvee-ring-buffer.h"
+
+//
+// The number of clocks is picked at startup (glibc.mvee.clock_count) and
+// rounded down to a power of two. Queue entries encode the clock index in
+// the low MVEE_CLOCK_IDX_BITS bits, and index 0 is never used.
+//
+#define MVEE_CLOCK_IDX_BITS      16
+#define MVEE_CLOCK_IDX_MASK      ((1ul << MVEE_CLOCK_IDX_BITS) - 1)
+#define MVEE_MIN_CLOCK_COUNT     64
+#define MVEE_MAX_CLOCK_COUNT     (1u << (MVEE_CLOCK_IDX_BITS - 1))
+
+//
+// In the leader, every clock is a ticket lock. A thread draws a ticket with a
+// single fetch-and-add and the counter doubles as the "now serving" field, so
+// the ticket is exactly the counter value the followers must wait for before
+// they can replay the operation. In the followers, only the counter is used.
+//
+// The telemetry fields are only written by the leader's ticket holder, and
+// can be read by the monitor to size the clock table for a workload.
+//
 struct mvee_counter
 {
-  volatile unsigned long lock;
+  volatile unsigned long ticket;
   volatile unsigned long counter;
-  unsigned char padding[64 - 2 * sizeof(unsigned long)]; // prevents false sharing
+  volatile unsigned int  waiters;     // nr of followers sleeping on the counter, only used with MVEE_WAIT_ADAPTIVE
+  unsigned long          last_word;   // the last word that was synced on this clock
+  unsigned long          collisions;  // nr of times consecutive ops on this clock were on different words
+  unsigned long          contended;   // nr of times the leader had to wait for another ticket holder
+  unsigned char padding[64 - 6 * sizeof(unsigned long)]; // prevents false sharing (waiters is padded to a long)
 };
 
 struct mvee_op_entry
@@ -16,24 +39,435 @@ struct mvee_op_entry
   volatile unsigned long  counter_and_idx; // the value we must see in mvee_counters[idx] before we can replay the operation
 };
 
+// A follower that goes to sleep on an empty queue slot marks it with this
+// value first. Clock index 0 is never used, so this can't be a real entry.
+#define MVEE_OP_ENTRY_WAITING    (1ul << MVEE_CLOCK_IDX_BITS)
+
+// In ring buffer mode, entries written on odd laps through the queue have this
+// bit set, so a follower can tell a new entry from the one it replaces. The
+// leader never gets more than one lap ahead of the slowest follower.
+//
+// Entries can take more than one slot, so on the next lap, an entry can start
+// on a slot that held the second half of an entry on this lap. The extra
+// slots therefore hold their data above the clock index (mvee_op_data), with
+// the index and the flags clear, so that a follower never takes them for an
+// entry. The leader also clears the slots it skips at the end of a lap, or a
+// follower could find an entry from two laps ago there, with the right lap
+// bit.
+#define MVEE_OP_ENTRY_LAP        (1ul << 63)
+
+// Marks an entry for a load-only atomic with glibc.mvee.load_replication.
+// Such an entry takes two slots for loads of up to 4 bytes, and three for
+// larger loads: this marker, and the value the leader loaded, 32 bits per
+// slot.
+#define MVEE_OP_ENTRY_VALUE      (1ul << 62)
+
+// Marks an entry that holds the MVEE_CALL_SITE of the operation in the next
+// slot, with glibc.mvee.call_site_checks.
+#define MVEE_OP_ENTRY_SITE       (1ul << 61)
+
+// Marks a lock-level event with glibc.mvee.lock_replication that has its
+// details in the next slot: the nr of futex waits for an acquisition, or
+// MVEE_LOCK_INFO_WOKE for a release. Encoded with mvee_op_data.
+#define MVEE_OP_ENTRY_LOCK_INFO  (1ul << 60)
+
+// Marks a failed lock acquisition with glibc.mvee.lock_replication. These
+// aren't ordered, so the counter bits hold the error instead.
+#define MVEE_OP_ENTRY_LOCK_FAIL  (1ul << 59)
+
+#define MVEE_LOCK_INFO_WOKE      (1ul << 32)
+
+// Encodes the data in an extra slot of an entry. @data can have up to 43 bits.
+static inline unsigned long mvee_op_data(unsigned long data)
+{
+	return data << MVEE_CLOCK_IDX_BITS;
+}
+
+static inline unsigned long mvee_op_data_get(unsigned long slot)
+{
+	return slot >> MVEE_CLOCK_IDX_BITS;
+}
+
+// The queue itself is mvee_thread_state.atomic_queue, so that it is cleared in forked children
 static __thread unsigned long         mvee_thread_local_pos         = 0; // our position in the thread local queue
-static __thread  
-    struct mvee_op_entry*             mvee_thread_local_queue       = NULL;
 static __thread unsigned long         mvee_thread_local_queue_size  = 0; // nr of slots in the thread local queue
 static __thread unsigned short        mvee_prev_idx                 = 0;
-
-__attribute__((aligned (64)))
-static struct mvee_counter            mvee_counters[MVEE_TOTAL_CLOCK_COUNT + 1];
-__attribute__((aligned (64)))
+// ring buffer mode only
+static __thread void*                 mvee_thread_local_ring        = NULL; // the header in front of the queue
+static __thread unsigned long         mvee_thread_local_seq         = 0; // nr of entries we've written or replayed
+static __thread unsigned long         mvee_thread_local_lap         = 0; // MVEE_OP_ENTRY_LAP on odd laps
+static __thread unsigned long         mvee_thread_local_min_consumed = 0; // leader only
+
+// Not static: the monitor looks these up to read the clock telemetry
+struct mvee_counter*                  mvee_counters;
 struct mvee_counter*                  mvee_variantwide_counters;
+unsigned int                          mvee_clock_count              = 2048;
+static unsigned int                   mvee_clock_bits               = 11;
 
 void mvee_invalidate_buffer(void)
 {
-	mvee_thread_local_queue = NULL;
+	mvee_thread_state.atomic_queue = NULL;
+	mvee_thread_state.control.version = 0;
+}
+
+//
+// Maps the clocks. The MVEE can turn sync on after startup, so this also runs
+// when the first queue is attached. Threads can race to get here then, and
+// only the first mapping is kept.
+//
+static void mvee_map_clocks(void)
+{
+	size_t size = (mvee_clock_count + 1) * sizeof(struct mvee_counter);
+	struct mvee_counter* clocks = (struct mvee_counter*) orig_MMAP_CALL(NULL, size,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (orig_atomic_compare_and_exchange_bool_acq(&mvee_counters, clocks, NULL))
+		orig_MUNMAP_CALL(clocks, size);
+}
+
+// Called once at startup, after we know whether we run under MVEE control
+static void mvee_agent_setup(void)
+{
+	unsigned int count = mvee_clock_count;
+
+	if (count < MVEE_MIN_CLOCK_COUNT)
+		count = MVEE_MIN_CLOCK_COUNT;
+	else if (count > MVEE_MAX_CLOCK_COUNT)
+		count = MVEE_MAX_CLOCK_COUNT;
+
+	// round down to a power of two
+	while (count & (count - 1))
+		count &= count - 1;
+
+	mvee_clock_count = count;
+	mvee_clock_bits  = __builtin_ctz(count);
+
+	// Even if sync is still off: the MVEE may turn it on later
+	if (mvee_hooks_enabled && !mvee_counters)
+		mvee_map_clocks();
+}
+
+//
+// Maps a word onto a clock. Words in the same cache line share a clock. The
+// line number is spread with a multiplicative (Fibonacci) hash so that heap,
+// stack and TLS locks that are a page or a 16 MiB region apart don't end up
+// on the same clock.
+//
+static inline unsigned short mvee_clock_index(volatile void* word_ptr)
+{
+	return (unsigned short)((((unsigned long)word_ptr >> 6) * 0x9E3779B97F4A7C15ul) >> (64 - mvee_clock_bits)) + 1;
+}
+
+// ========================================================================================================================
+// FOLLOWER WAIT LOGIC
+// ========================================================================================================================
+
+//
+// Backs off once while waiting for the leader or a preceding follower thread.
+// @waited is the number of times we've backed off already. Returns 1 if the
+// caller should now go to sleep on a futex. Under MVEE_WAIT_YIELD, shared
+// memory operations keep spinning because the leader might wait for us there.
+// The caller counts whatever it does instead of sleeping as a backoff with
+// @waited != 0.
+//
+static inline unsigned char mvee_backoff(unsigned int waited, unsigned char is_shared)
+{
+	switch (mvee_wait_policy)
+	{
+		case MVEE_WAIT_ADAPTIVE:
+			if (waited < mvee_spin_count)
+				break;
+			if (waited < mvee_spin_count + mvee_yield_count)
+			{
+				mvee_stats_count_backoff(waited, MVEE_STATS_YIELD);
+				syscall(__NR_sched_yield);
+				return 0;
+			}
+			if (!waited)
+				mvee_stats_wait_begin();
+			return 1;
+		case MVEE_WAIT_YIELD:
+			if (!is_shared)
+			{
+				mvee_stats_count_backoff(waited, MVEE_STATS_YIELD);
+				syscall(__NR_sched_yield);
+				return 0;
+			}
+			break;
+	}
+
+	mvee_stats_count_backoff(waited, MVEE_STATS_SPIN);
+	arch_cpu_relax();
+	return 0;
+}
+
+static unsigned long mvee_wait_for_op_entry(volatile unsigned long* slot, unsigned char is_shared)
+{
+	unsigned long counter_and_idx;
+	unsigned int waited = 0;
+
+	while (unlikely(1))
+	{
+		counter_and_idx = *slot;
+
+		if (likely((counter_and_idx & (MVEE_CLOCK_IDX_MASK | MVEE_OP_ENTRY_VALUE | MVEE_OP_ENTRY_SITE | MVEE_OP_ENTRY_LOCK_FAIL)) &&
+				   (counter_and_idx & MVEE_OP_ENTRY_LAP) == mvee_thread_local_lap))
+		{
+			mvee_stats_wait_end(waited);
+			return counter_and_idx;
+		}
+
+		if (!mvee_backoff(waited++, is_shared))
+			continue;
+
+		// In ring buffer mode, the slot might still hold an entry that a
+		// slower follower has to read, so we can't mark it. Just yield.
+		if (mvee_thread_local_ring)
+		{
+			mvee_stats_count_backoff(waited, MVEE_STATS_YIELD);
+			syscall(__NR_sched_yield);
+			continue;
+		}
+
+		// Tell the leader that we're going to sleep on this slot. If the CAS
+		// fails, the leader has filled in the slot in the meantime. The slot
+		// is in a buffer that is shared with the leader's process, so we
+		// can't use a private futex here.
+		if (counter_and_idx == MVEE_OP_ENTRY_WAITING ||
+			orig_atomic_compare_and_exchange_bool_acq(slot, MVEE_OP_ENTRY_WAITING, 0) == 0)
+		{
+			mvee_stats_count_backoff(waited, MVEE_STATS_SLEEP);
+			lll_futex_wait((volatile unsigned int*)slot, (unsigned int)MVEE_OP_ENTRY_WAITING, LLL_SHARED);
+		}
+	}
+}
+
+static void mvee_wait_for_counter(struct mvee_counter* clock, unsigned long expected, unsigned char is_shared)
+{
+	unsigned int waited = 0;
+	int private = is_shared ? LLL_SHARED : LLL_PRIVATE;
+
+	while ((clock->counter << MVEE_CLOCK_IDX_BITS) != expected)
+	{
+		if (!mvee_backoff(waited++, is_shared))
+			continue;
+
+		// Announce ourselves before rechecking the counter. The thread that
+		// bumps the counter checks for waiters after the increment.
+		orig_atomic_increment(&clock->waiters);
+		unsigned long counter = clock->counter;
+		if ((counter << MVEE_CLOCK_IDX_BITS) != expected)
+		{
+			mvee_stats_count_backoff(waited, MVEE_STATS_SLEEP);
+			lll_futex_wait((volatile unsigned int*)&clock->counter, (unsigned int)counter, private);
+		}
+		orig_atomic_decrement(&clock->waiters);
+	}
+
+	mvee_stats_wait_end(waited);
+}
+
+static inline void mvee_wake_counter_waiters(struct mvee_counter* clock, unsigned char is_shared)
+{
+	if (likely(mvee_wait_policy != MVEE_WAIT_ADAPTIVE))
+		return;
+
+	atomic_full_barrier();
+	if (unlikely(clock->waiters))
+		lll_futex_wake((volatile unsigned int*)&clock->counter, INT_MAX, is_shared ? LLL_SHARED : LLL_PRIVATE);
+}
+
+// ========================================================================================================================
+// LEADER CLOCK LOGIC
+// ========================================================================================================================
+
+//
+// Draws a ticket on the clock and waits until it is served. We can't drop the
+// wait: two leader threads that draw consecutive tickets on the same clock must
+// also perform their operations in ticket order, or the followers would replay
+// them in a different order. We only spin when another thread is inside an
+// operation on the same clock, though, and never retry a failed RMW.
+//
+static inline unsigned long mvee_clock_acquire(struct mvee_counter* clock, volatile void* word_ptr, unsigned char is_shared)
+{
+	unsigned long ticket = orig_atomic_exchange_and_add(&clock->ticket, 1);
+	unsigned int waited = 0;
+
+	while (clock->counter != ticket)
+	{
+		// No futex sleeps here. The previous ticket holder never issues wakes.
+		if (mvee_backoff(waited++, is_shared))
+		{
+			mvee_stats_count_backoff(waited, MVEE_STATS_YIELD);
+			syscall(__NR_sched_yield);
+		}
+	}
+
+	// We own the clock now, so the telemetry needs no atomics
+	if (unlikely(waited))
+	{
+		clock->contended++;
+		mvee_stats_wait_end(waited);
+	}
+	if (unlikely(clock->last_word != (unsigned long)word_ptr))
+	{
+		if (clock->last_word)
+			clock->collisions++;
+		clock->last_word = (unsigned long)word_ptr;
+	}
+
+	return ticket;
+}
+
+// Hands the clock to the next ticket. Only the ticket holder writes the counter.
+static inline void mvee_clock_release(struct mvee_counter* clock)
+{
+	orig_atomic_store_release(&clock->counter, clock->counter + 1);
+}
+
+// ========================================================================================================================
+// THREAD-LOCAL QUEUE
+// ========================================================================================================================
+
+// What the MVEE needs to know to set up our queue (mvee_get_thread_control)
+static inline void mvee_agent_describe_thread(struct mvee_thread_control* control)
+{
+	control->clocks    = mvee_counters;
+	control->queue_pos = &mvee_thread_local_pos;
+}
+
+static void mvee_attach_thread_local_queue(void)
+{
+	if (unlikely(!mvee_counters))
+		mvee_map_clocks();
+
+	struct mvee_thread_control* control = mvee_get_thread_control();
+	long mvee_thread_local_queue_id;
+
+	// The block is stale if we got it before the clocks were mapped. The
+	// MVEE then set up the queue without them, so ask for it again.
+	if (likely(control && control->clocks == mvee_counters &&
+			   control->buffers[MVEE_THREAD_ATOMIC_BUFFER].id >= 0))
+	{
+		mvee_thread_local_queue_id   = control->buffers[MVEE_THREAD_ATOMIC_BUFFER].id;
+		mvee_thread_local_queue_size = control->buffers[MVEE_THREAD_ATOMIC_BUFFER].size;
+	}
+	else
+	{
+		mvee_thread_local_queue_id = syscall(MVEE_GET_SHARED_BUFFER, mvee_counters, MVEE_LIBC_ATOMIC_BUFFER, &mvee_thread_local_queue_size, &mvee_thread_local_pos, NULL);
+		syscall(MVEE_RESET_ATFORK, &mvee_thread_state.atomic_queue, sizeof(mvee_thread_state.atomic_queue));
+	}
+
+	void* queue = (void*)syscall(__NR_shmat, mvee_thread_local_queue_id, NULL, 0);
+	if (mvee_ring_buffers)
+	{
+		mvee_thread_local_ring        = queue;
+		queue                         = (char*)queue + MVEE_RING_HEADER_SIZE;
+		mvee_thread_local_queue_size -= MVEE_RING_HEADER_SIZE;
+	}
+	mvee_thread_local_queue_size   /= sizeof(struct mvee_op_entry);
+	mvee_thread_state.atomic_queue  = queue;
+	mvee_thread_local_pos = 0;
+	mvee_thread_local_seq = mvee_thread_local_lap = mvee_thread_local_min_consumed = 0;
+}
+
+// Sets up the calling thread's queue before its first operation (mvee_thread_bootstrap)
+static void mvee_agent_attach_thread(void)
+{
+	if (mvee_sync_enabled && !mvee_thread_state.atomic_queue)
+		mvee_attach_thread_local_queue();
+}
+
+//
+// Starts a new lap through the queue in ring buffer mode, or flushes it. The
+// leader and the followers both call this at the same position, so any slots
+// we skip at the end of the queue count as consumed.
+//
+static void mvee_wrap_thread_local_queue(void)
+{
+	if (mvee_thread_local_ring)
+	{
+		unsigned long skipped = mvee_thread_local_queue_size - mvee_thread_local_pos;
+
+		// See MVEE_OP_ENTRY_LAP
+		if (skipped && mvee_master_variant)
+		{
+			mvee_ring_wait_for_space(mvee_thread_local_ring, mvee_thread_local_seq + skipped,
+									 mvee_thread_local_queue_size, &mvee_thread_local_min_consumed);
+			for (unsigned long i = mvee_thread_local_pos; i < mvee_thread_local_queue_size; ++i)
+				mvee_thread_state.atomic_queue[i].counter_and_idx = 0;
+		}
+
+		mvee_thread_local_seq += skipped;
+		mvee_thread_local_lap ^= MVEE_OP_ENTRY_LAP;
+	}
+	else
+	{
+		mvee_stats_count_flushes();
+		syscall(MVEE_FLUSH_SHARED_BUFFER, MVEE_LIBC_ATOMIC_BUFFER);
+	}
+	mvee_thread_local_pos = 0;
+}
+
+static inline void mvee_publish_op_entry(volatile unsigned long* slot, unsigned long entry)
+{
+	if (unlikely(mvee_wait_policy == MVEE_WAIT_ADAPTIVE && !mvee_thread_local_ring))
+	{
+		// The follower might be sleeping on this slot. Only wake it if it
+		// has told us that it is.
+		if (orig_atomic_exchange_acq(slot, entry) == MVEE_OP_ENTRY_WAITING)
+			lll_futex_wake((volatile unsigned int*)slot, INT_MAX, LLL_SHARED);
+	}
+	else
+	{
+		*slot = entry;
+	}
+}
+
+//
+// Logs the call site of the operation we're about to replicate in a slot of
+// its own (leader), or checks it against our own (followers).
+//
+static void __attribute__((noinline)) mvee_check_call_site(unsigned short op_type, unsigned int call_site, unsigned char is_shared)
+{
+	if (unlikely(mvee_thread_local_pos >= mvee_thread_local_queue_size))
+		mvee_wrap_thread_local_queue();
+
+	volatile unsigned long* slot = &mvee_thread_state.atomic_queue[mvee_thread_local_pos++].counter_and_idx;
+	mvee_thread_local_seq++;
+
+	if (likely(mvee_master_variant))
+	{
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_wait_for_space(mvee_thread_local_ring, mvee_thread_local_seq,
+									 mvee_thread_local_queue_size, &mvee_thread_local_min_consumed);
+
+		mvee_publish_op_entry(slot, MVEE_OP_ENTRY_SITE | call_site | mvee_thread_local_lap);
+	}
+	else
+	{
+		unsigned long entry = mvee_wait_for_op_entry(slot, is_shared);
+
+		// The leader must have checked this operation too
+		if (unlikely(!(entry & MVEE_OP_ENTRY_SITE)))
+			*(volatile int*) 0 = 0x0bad1dea;
+
+		if (unlikely((unsigned int) entry != call_site))
+			mvee_call_site_mismatch(op_type, (unsigned int) entry, call_site);
+
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_consume(mvee_thread_local_ring, mvee_thread_local_seq);
+	}
 }
 
-unsigned char mvee_atomic_preop_internal(volatile void* word_ptr)
+unsigned char mvee_atomic_preop_internal(unsigned short op_type, volatile void* word_ptr, unsigned int call_site)
 {
+	mvee_stats_count_preop(op_type);
+
+	// SHM stores and checks we've held back must not move past this operation
+	if (unlikely(mvee_shm_deferred_ops))
+		mvee_shm_complete_deferred_ops();
+
 	// Tagged pointer => SHM
 	unsigned char is_shared = 0;
 	if (unlikely((unsigned long long) word_ptr & 0x8000000000000000ull))
@@ -42,7 +476,7 @@ unsigned char mvee_atomic_preop_internal(volatile void* word_ptr)
 		// We use a variant-wide SHARED_BUFFER for this.
 		if (unlikely(!mvee_variantwide_counters))
 		{
-			long id = syscall(MVEE_GET_SHARED_BUFFER, 0, MVEE_LIBC_VARIANTWIDE_ATOMIC_BUFFER, NULL, (MVEE_TOTAL_CLOCK_COUNT + 1) * sizeof(struct mvee_counter));
+			long id = syscall(MVEE_GET_SHARED_BUFFER, 0, MVEE_LIBC_VARIANTWIDE_ATOMIC_BUFFER, NULL, (mvee_clock_count + 1) * sizeof(struct mvee_counter));
 			mvee_variantwide_counters = (void*)syscall(__NR_shmat, id, NULL, 0);
 		}
 
@@ -51,49 +485,38 @@ unsigned char mvee_atomic_preop_internal(volatile void* word_ptr)
 	}
 	else if (unlikely(!mvee_sync_enabled))
 		return 0;
+	else if (mvee_word_is_private(word_ptr))
+		return 0;
 
-	if (unlikely(!mvee_thread_local_queue))
-    {
-		long mvee_thread_local_queue_id = syscall(MVEE_GET_SHARED_BUFFER, &mvee_counters, MVEE_LIBC_ATOMIC_BUFFER, &mvee_thread_local_queue_size, &mvee_thread_local_pos, NULL);
-		syscall(MVEE_RESET_ATFORK, &mvee_thread_local_queue, sizeof(&mvee_thread_local_queue));
-		mvee_thread_local_queue_size   /= sizeof(struct mvee_op_entry);
-		mvee_thread_local_queue         = (void*)syscall(__NR_shmat, mvee_thread_local_queue_id, NULL, 0);     
-		mvee_thread_local_pos = 0;
-    }
+	if (unlikely(!mvee_thread_state.atomic_queue))
+		mvee_attach_thread_local_queue();
+
+	if (unlikely(mvee_should_check_call_site()))
+		mvee_check_call_site(op_type, call_site, is_shared);
 
 	if (unlikely(mvee_thread_local_pos >= mvee_thread_local_queue_size))
-    {
-		syscall(MVEE_FLUSH_SHARED_BUFFER, MVEE_LIBC_ATOMIC_BUFFER);
-		mvee_thread_local_pos = 0;
-    }
+		mvee_wrap_thread_local_queue();
 
 	if (likely(mvee_master_variant))
     {
 		unsigned long counter;
-		// page number defines the clock group
-		// offset within page defines the clock within that group
-		mvee_prev_idx = (((((unsigned long)word_ptr >> 24) % MVEE_TOTAL_CLOCK_GROUPS) * (MVEE_CLOCK_GROUP_SIZE)
-					+ ((((unsigned long)word_ptr & 0xFFF) >> 6) % MVEE_CLOCK_GROUP_SIZE)) & 0xFFF) + 1;
+		mvee_prev_idx = mvee_clock_index(word_ptr);
+
+		// Don't overwrite entries the followers still need. We wait before
+		// we draw a ticket, so we never hold up other leader threads.
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_wait_for_space(mvee_thread_local_ring, ++mvee_thread_local_seq,
+									 mvee_thread_local_queue_size, &mvee_thread_local_min_consumed);
 
 		if (unlikely(is_shared))
-		{
 			// sync op on shared memory, use variant-wide WoC
-			while (!__sync_bool_compare_and_swap(&mvee_variantwide_counters[mvee_prev_idx].lock, 0, 1))
-				arch_cpu_relax();
-
-			counter = mvee_variantwide_counters[mvee_prev_idx].counter;
-		}
+			counter = mvee_clock_acquire(&mvee_variantwide_counters[mvee_prev_idx], word_ptr, 1);
 		else
-		{
 			// sync op on private memory, use process-wide WoC
-			while (!__sync_bool_compare_and_swap(&mvee_counters[mvee_prev_idx].lock, 0, 1))
-				arch_cpu_relax();
-
-			counter = mvee_counters[mvee_prev_idx].counter;
-		}
+			counter = mvee_clock_acquire(&mvee_counters[mvee_prev_idx], word_ptr, 0);
 
-		mvee_thread_local_queue[mvee_thread_local_pos++].counter_and_idx
-			= (counter << 12) | mvee_prev_idx;
+		mvee_publish_op_entry(&mvee_thread_state.atomic_queue[mvee_thread_local_pos++].counter_and_idx,
+							  (counter << MVEE_CLOCK_IDX_BITS) | mvee_prev_idx | mvee_thread_local_lap);
 
 		atomic_full_barrier();
 
@@ -101,44 +524,17 @@ unsigned char mvee_atomic_preop_internal(volatile void* word_ptr)
     }
 	else
     {
-		unsigned long counter_and_idx = 0;
+		unsigned long counter_and_idx = mvee_wait_for_op_entry(&mvee_thread_state.atomic_queue[mvee_thread_local_pos].counter_and_idx, is_shared);
 
-		while (unlikely(1))
-		{
-			counter_and_idx = mvee_thread_local_queue[mvee_thread_local_pos].counter_and_idx;
-
-			if (likely(counter_and_idx))
-				break;
-
-#ifdef MVEE_SLAVE_YIELD
-			if (is_shared)
-				arch_cpu_relax();// Don't yield for shared memory, master might wait for us there
-			else
-				syscall(__NR_sched_yield);
-#else
-			arch_cpu_relax();
-#endif
-		}
-
-		mvee_prev_idx = counter_and_idx & 0xFFF;
-		counter_and_idx &= ~0xFFF;
+		mvee_prev_idx = counter_and_idx & MVEE_CLOCK_IDX_MASK;
+		counter_and_idx &= ~(MVEE_CLOCK_IDX_MASK | MVEE_OP_ENTRY_LAP);
 
 		atomic_full_barrier();
 
 		if (unlikely(is_shared))
-		{
-			while ((mvee_variantwide_counters[mvee_prev_idx].counter << 12) != counter_and_idx)
-				arch_cpu_relax();// Don't yield for shared memory, master might wait for us there
-		}
+			mvee_wait_for_counter(&mvee_variantwide_counters[mvee_prev_idx], counter_and_idx, 1);
 		else
-		{
-			while ((mvee_counters[mvee_prev_idx].counter << 12) != counter_and_idx)
-#ifdef MVEE_SLAVE_YIELD
-				syscall(__NR_sched_yield);
-#else
-				arch_cpu_relax();
-#endif
-		}
+			mvee_wait_for_counter(&mvee_counters[mvee_prev_idx], counter_and_idx, 0);
 
 		atomic_full_barrier();
 		
@@ -154,29 +550,321 @@ void mvee_atomic_postop_internal(unsigned char preop_result)
 	{
 		gcc_barrier();
 		if (unlikely(preop_result & 4))
-		{
 			// sync op on shared memory, use variant-wide WoC
-			orig_atomic_increment(&mvee_variantwide_counters[mvee_prev_idx].counter);
-			atomic_full_barrier();
-			mvee_variantwide_counters[mvee_prev_idx].lock = 0;
-		}
+			mvee_clock_release(&mvee_variantwide_counters[mvee_prev_idx]);
 		else
-		{
 			// sync op on private memory, use process-wide WoC
-			orig_atomic_increment(&mvee_counters[mvee_prev_idx].counter);
-			atomic_full_barrier();
-			mvee_counters[mvee_prev_idx].lock = 0;
-		}
+			mvee_clock_release(&mvee_counters[mvee_prev_idx]);
 	}
 	else if (likely(preop_result & 2))
 	{
 		gcc_barrier();
 		if (unlikely(preop_result & 4)) // sync op on shared memory, use variant-wide WoC
+		{
 			mvee_variantwide_counters[mvee_prev_idx].counter++;
+			mvee_wake_counter_waiters(&mvee_variantwide_counters[mvee_prev_idx], 1);
+		}
 		else // sync op on private memory, use process-wide WoC
+		{
 			mvee_counters[mvee_prev_idx].counter++;
+			mvee_wake_counter_waiters(&mvee_counters[mvee_prev_idx], 0);
+		}
 		mvee_thread_local_pos++;
+
+		// Let the leader reuse the slot
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_consume(mvee_thread_local_ring, ++mvee_thread_local_seq);
+	}
+}
+
+//
+// Relaxed atomic loads with glibc.mvee.load_replication. The caller has already
+// loaded *@word_ptr into @value. The leader logs the value in the thread-local
+// queue, and the followers overwrite theirs with it. This doesn't touch the
+// clocks, so only stores and RMWs are ordered. SHM loads never get here.
+//
+void mvee_atomic_replicate_load(volatile void* word_ptr, void* value, unsigned long size)
+{
+	unsigned long val = 0;
+
+	if (unlikely(!mvee_sync_enabled) || mvee_word_is_private(word_ptr))
+		return;
+
+	if (unlikely(!mvee_thread_state.atomic_queue))
+		mvee_attach_thread_local_queue();
+
+	// We need consecutive slots
+	unsigned long slots = size > 4 ? 3 : 2;
+	if (unlikely(mvee_thread_local_pos + slots > mvee_thread_local_queue_size))
+		mvee_wrap_thread_local_queue();
+
+	volatile unsigned long* slot = &mvee_thread_state.atomic_queue[mvee_thread_local_pos].counter_and_idx;
+	mvee_thread_local_pos += slots;
+	mvee_thread_local_seq += slots;
+
+	if (likely(mvee_master_variant))
+	{
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_wait_for_space(mvee_thread_local_ring, mvee_thread_local_seq,
+									 mvee_thread_local_queue_size, &mvee_thread_local_min_consumed);
+
+		__builtin_memcpy(&val, value, size);
+		slot[1] = mvee_op_data((unsigned int) val);
+		if (slots > 2)
+			slot[2] = mvee_op_data(val >> 32);
+		atomic_write_barrier();
+		mvee_publish_op_entry(slot, MVEE_OP_ENTRY_VALUE | mvee_thread_local_lap);
+	}
+	else
+	{
+		// The leader must have done a load here too
+		if (unlikely(!(mvee_wait_for_op_entry(slot, 0) & MVEE_OP_ENTRY_VALUE)))
+			*(volatile int*) 0 = 0x0bad1dea;
+
+		atomic_read_barrier();
+		val = mvee_op_data_get(slot[1]);
+		if (slots > 2)
+			val |= mvee_op_data_get(slot[2]) << 32;
+		__builtin_memcpy(value, &val, size);
+
+		if (unlikely(mvee_thread_local_ring != NULL))
+			mvee_ring_consume(mvee_thread_local_ring, mvee_thread_local_seq);
+	}
+}
+
+// ========================================================================================================================
+// LOCK-LEVEL REPLICATION
+// ========================================================================================================================
+
+//
+// With glibc.mvee.lock_replication, the lll_lock words in libc and libpthread
+// log one event when they're acquired and one when they're released, instead
+// of one for every atomic we do on them. The leader takes and drops its locks
+// natively. It only draws a ticket on the lock's clock once it holds the lock,
+// and right before it releases it, so the tickets of a lock alternate between
+// acquisitions and releases. The followers never contend for a lock: they wait
+// for their turn and then simply take or drop it.
+//
+// The leader also logs how often it went to sleep on a lock before it got it,
+// so that the followers can make the same futex calls, and whether it had to
+// wake a waiter when it dropped it. That goes in a second slot, which is only
+// used if there's something to tell. Failed trylocks and timed out locks
+// aren't ordered: they only log the error.
+//
+// This only works if every operation on a lock word goes through here, so
+// lowlevellock.h takes care of the dispatching. Lock words in private memory
+// are never replicated.
+//
+
+//
+// Returns the slot for the next lock-level event. We always keep two slots
+// free for it: the leader doesn't know whether it needs the second one until it
+// publishes the event, and the followers must wrap at the same position.
+//
+static inline volatile unsigned long* mvee_lock_slot(void)
+{
+	if (unlikely(!mvee_thread_state.atomic_queue))
+		mvee_attach_thread_local_queue();
+
+	if (unlikely(mvee_thread_local_pos + 1 >= mvee_thread_local_queue_size))
+		mvee_wrap_thread_local_queue();
+
+	return &mvee_thread_state.atomic_queue[mvee_thread_local_pos].counter_and_idx;
+}
+
+// Leader only. Must be called before we draw a ticket.
+static inline void mvee_lock_wait_for_space(void)
+{
+	if (unlikely(mvee_thread_local_ring != NULL))
+		mvee_ring_wait_for_space(mvee_thread_local_ring, mvee_thread_local_seq + 2,
+								 mvee_thread_local_queue_size, &mvee_thread_local_min_consumed);
+}
+
+// Leader only. Publishes a lock-level event, with @info in the next slot if
+// it isn't 0.
+static void mvee_lock_publish(volatile unsigned long* slot, unsigned long entry, unsigned long info)
+{
+	unsigned long slots = 1;
+
+	if (info)
+	{
+		slot[1] = mvee_op_data(info);
+		atomic_write_barrier();
+		entry |= MVEE_OP_ENTRY_LOCK_INFO;
+		slots = 2;
 	}
+
+	mvee_publish_op_entry(slot, entry | mvee_thread_local_lap);
+	mvee_thread_local_pos += slots;
+	mvee_thread_local_seq += slots;
+}
+
+// Follower only. Reads the next lock-level event and its details, and lets
+// the leader reuse the slots. Returns the entry without the lap bit.
+static unsigned long mvee_lock_read(volatile unsigned long* slot, unsigned long* info)
+{
+	unsigned long entry = mvee_wait_for_op_entry(slot, 0);
+	unsigned long slots = 1;
+
+	// The leader must have done a lock operation here too
+	if (unlikely(entry & (MVEE_OP_ENTRY_VALUE | MVEE_OP_ENTRY_SITE)))
+		*(volatile int*) 0 = 0x0bad1dea;
+
+	*info = 0;
+	if (entry & MVEE_OP_ENTRY_LOCK_INFO)
+	{
+		atomic_read_barrier();
+		*info = mvee_op_data_get(slot[1]);
+		slots = 2;
+	}
+
+	mvee_thread_local_pos += slots;
+	mvee_thread_local_seq += slots;
+	if (unlikely(mvee_thread_local_ring != NULL))
+		mvee_ring_consume(mvee_thread_local_ring, mvee_thread_local_seq);
+
+	return entry & ~MVEE_OP_ENTRY_LAP;
+}
+
+//
+// Called before we try to acquire @lock. Returns -1 if the caller must
+// acquire the lock natively: in the leader, and for words we don't replicate.
+// Otherwise, returns 0 if the leader got the lock, and the error it got if it
+// didn't. @waits is set to the nr of futex waits the follower must repeat.
+// @turn must be passed on to mvee_lock_acquired or mvee_lock_failed. It is
+// 0 if the lock isn't replicated, and in followers that must fail.
+//
+int mvee_lock_replay(volatile void* lock, unsigned long* turn, unsigned int* waits)
+{
+	*turn  = 0;
+	*waits = 0;
+
+	if (unlikely(!mvee_sync_enabled) || mvee_word_is_private(lock))
+		return -1;
+
+	// SHM stores and checks we've held back must not move past this operation
+	if (unlikely(mvee_shm_deferred_ops))
+		mvee_shm_complete_deferred_ops();
+
+	if (likely(mvee_master_variant))
+	{
+		*turn = MVEE_LOCK_LEADER;
+		return -1;
+	}
+
+	unsigned long info;
+	unsigned long entry = mvee_lock_read(mvee_lock_slot(), &info);
+	*waits = (unsigned int) info;
+
+	if (unlikely(entry & MVEE_OP_ENTRY_LOCK_FAIL))
+		return (int)((entry & ~(MVEE_OP_ENTRY_LOCK_FAIL | MVEE_OP_ENTRY_LOCK_INFO)) >> MVEE_CLOCK_IDX_BITS);
+
+	mvee_wait_for_counter(&mvee_counters[entry & MVEE_CLOCK_IDX_MASK],
+						  entry & ~(MVEE_CLOCK_IDX_MASK | MVEE_OP_ENTRY_LOCK_INFO), 0);
+	atomic_full_barrier();
+
+	*turn = entry;
+	return 0;
+}
+
+// Called once we hold @lock. @waits is the nr of futex waits it took.
+void mvee_lock_acquired(unsigned long turn, volatile void* lock, unsigned int waits)
+{
+	if (likely(turn == MVEE_LOCK_LEADER))
+	{
+		unsigned short idx = mvee_clock_index(lock);
+		volatile unsigned long* slot = mvee_lock_slot();
+
+		mvee_lock_wait_for_space();
+		unsigned long ticket = mvee_clock_acquire(&mvee_counters[idx], lock, 0);
+		mvee_lock_publish(slot, (ticket << MVEE_CLOCK_IDX_BITS) | idx, waits);
+		atomic_full_barrier();
+		mvee_clock_release(&mvee_counters[idx]);
+	}
+	else
+	{
+		struct mvee_counter* clock = &mvee_counters[turn & MVEE_CLOCK_IDX_MASK];
+
+		atomic_full_barrier();
+		clock->counter++;
+		mvee_wake_counter_waiters(clock, 0);
+	}
+}
+
+// Leader only. Called if we didn't get the lock.
+void mvee_lock_failed(int err, unsigned int waits)
+{
+	volatile unsigned long* slot = mvee_lock_slot();
+
+	mvee_lock_wait_for_space();
+	mvee_lock_publish(slot, MVEE_OP_ENTRY_LOCK_FAIL | ((unsigned long) err << MVEE_CLOCK_IDX_BITS), waits);
+}
+
+//
+// Called right before we release @lock. Returns the turn to pass on to
+// mvee_lock_released, or 0 if the lock isn't replicated. The leader holds
+// the lock's clock until then.
+//
+unsigned long mvee_lock_release(volatile void* lock)
+{
+	if (unlikely(!mvee_sync_enabled) || mvee_word_is_private(lock))
+		return 0;
+
+	if (unlikely(mvee_shm_deferred_ops))
+		mvee_shm_complete_deferred_ops();
+
+	volatile unsigned long* slot = mvee_lock_slot();
+
+	if (likely(mvee_master_variant))
+	{
+		unsigned short idx = mvee_clock_index(lock);
+
+		mvee_lock_wait_for_space();
+		unsigned long ticket = mvee_clock_acquire(&mvee_counters[idx], lock, 0);
+		atomic_full_barrier();
+		return (ticket << MVEE_CLOCK_IDX_BITS) | idx;
+	}
+
+	unsigned long info;
+	unsigned long entry = mvee_lock_read(slot, &info);
+
+	// A release can't fail
+	if (unlikely(entry & MVEE_OP_ENTRY_LOCK_FAIL))
+		*(volatile int*) 0 = 0x0bad1dea;
+
+	mvee_wait_for_counter(&mvee_counters[entry & MVEE_CLOCK_IDX_MASK],
+						  entry & ~(MVEE_CLOCK_IDX_MASK | MVEE_OP_ENTRY_LOCK_INFO), 0);
+	atomic_full_barrier();
+
+	// Remember whether the leader woke a waiter
+	entry &= ~MVEE_OP_ENTRY_LOCK_INFO;
+	if (info & MVEE_LOCK_INFO_WOKE)
+		entry |= MVEE_OP_ENTRY_LOCK_INFO;
+	return entry;
+}
+
+//
+// Called right after we've released the lock, which had value @oldval. This
+// doesn't touch the lock, which might be gone already. Returns 1 if the
+// caller must wake a waiter: if there was one in the leader.
+//
+int mvee_lock_released(unsigned long turn, int oldval)
+{
+	struct mvee_counter* clock = &mvee_counters[turn & MVEE_CLOCK_IDX_MASK];
+
+	atomic_full_barrier();
+
+	if (likely(mvee_master_variant))
+	{
+		mvee_lock_publish(&mvee_thread_state.atomic_queue[mvee_thread_local_pos].counter_and_idx,
+						  turn, oldval > 1 ? MVEE_LOCK_INFO_WOKE : 0);
+		mvee_clock_release(clock);
+		return oldval > 1;
+	}
+
+	clock->counter++;
+	mvee_wake_counter_waiters(clock, 0);
+	return (turn & MVEE_OP_ENTRY_LOCK_INFO) != 0;
 }
 
 /* Checks if all variants got ALIGNMENT aligned heaps from
@@ -192,7 +880,7 @@ mvee_all_heaps_aligned(char* heap, unsigned long alloc_size)
 {
 	// if we're not running under MVEE control,
 	// just check the alignment of the current heap
-	if (!mvee_thread_local_queue)
+	if (!mvee_thread_state.atomic_queue)
 	{
 		if ((unsigned long)heap & (ALIGNMENT-1))
 			return 0;
@@ -212,7 +900,7 @@ int mvee_should_sync_tid(void)
 
 unsigned char mvee_atomic_preop(unsigned short op_type, void* word_ptr)
 {
-	return mvee_atomic_preop_internal(word_ptr);
+	return mvee_atomic_preop_internal(op_type + __MVEE_BASE_ATOMICS_MAX__, word_ptr, MVEE_EXTERNAL_CALL_SITE());
 }
 
 void mvee_atomic_postop(unsigned char preop_result)
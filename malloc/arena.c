@@ -82,6 +82,40 @@ __libc_lock_define_initialized (static, free_list_lock);
 static size_t narenas = 1;
 static mstate free_list;
 
+/* Deterministic arena assignment (glibc.malloc.deterministic_arenas).
+   Under the MVEE, a thread always uses arena (N % deterministic_arena_count),
+   where N is the creation index the monitor hands out for the thread, so
+   every variant assigns the same arena to the same thread.  Slot 0 is the
+   main arena.  The other arenas are created on first use, under list_lock.
+   Threads never move to another arena and arenas never go on the free list,
+   so free_list_lock, attached_threads and next_to_use are not used at all.
+   The dynamic thresholds are kept per arena, see arena_mmap_threshold.  */
+
+#define DETERMINISTIC_ARENAS_MAX 1024
+
+static mstate deterministic_arenas[DETERMINISTIC_ARENAS_MAX];
+static size_t deterministic_arena_count;
+
+/* Heap reservation pool.  Under the MVEE, every heap new_heap maps on its
+   own costs up to two monitor round-trips to check that it is aligned in
+   all variants.  Instead, new_heap takes heaps from a pool of HEAP_MAX_SIZE
+   aligned PROT_NONE address space, which is reserved and checked with the
+   monitor at once.  The first reservation is for HEAP_POOL_MIN_HEAPS
+   heaps, every next one for twice as many, up to HEAP_POOL_MAX_HEAPS.
+   Heaps do not go back to the pool: delete_heap unmaps them as before.
+   heap_pool_lock protects the pool.  new_heap may be called with an arena
+   mutex held, so it nests inside the arena mutexes.  */
+
+#define HEAP_POOL_MIN_HEAPS 4
+#define HEAP_POOL_MAX_HEAPS 64
+
+__libc_lock_define_initialized (static, heap_pool_lock);
+
+static int heap_pool_enabled;
+static char *heap_pool;
+static char *heap_pool_end;
+static size_t heap_pool_heaps = HEAP_POOL_MIN_HEAPS;
+
 /* list_lock prevents concurrent writes to the next member of struct
    malloc_state objects.
 
@@ -117,11 +151,18 @@ int __malloc_initialized = -1;
 
 #define arena_lock(ptr, size) do {					      \
       if (ptr)								      \
-        __libc_lock_lock (ptr->mutex);					      \
+        arena_mutex_lock (ptr);						      \
       else								      \
         ptr = arena_get2 ((size), NULL);				      \
   } while (0)
 
+/* Lock arena AV to allocate or free memory.  */
+
+#define arena_mutex_lock(av) do {					      \
+      __libc_lock_lock ((av)->mutex);					      \
+      ++(av)->lock_count;						      \
+  } while (0)
+
 /* find the heap and corresponding arena for a given ptr */
 
 #define heap_for_ptr(ptr) \
@@ -158,6 +199,8 @@ __malloc_fork_lock_parent (void)
       if (ar_ptr == &main_arena)
         break;
     }
+
+  __libc_lock_lock (heap_pool_lock);
 }
 
 void
@@ -166,6 +209,7 @@ __malloc_fork_unlock_parent (void)
   if (__malloc_initialized < 1)
     return;
 
+  __libc_lock_unlock (heap_pool_lock);
   for (mstate ar_ptr = &main_arena;; )
     {
       __libc_lock_unlock (ar_ptr->mutex);
@@ -182,6 +226,8 @@ __malloc_fork_unlock_child (void)
   if (__malloc_initialized < 1)
     return;
 
+  __libc_lock_init (heap_pool_lock);
+
   /* Push all arenas to the free list, except thread_arena, which is
      attached to the current thread.  */
   __libc_lock_init (free_list_lock);
@@ -237,6 +283,7 @@ TUNABLE_CALLBACK_FNDECL (set_tcache_count, size_t)
 TUNABLE_CALLBACK_FNDECL (set_tcache_unsorted_limit, size_t)
 #endif
 TUNABLE_CALLBACK_FNDECL (set_mxfast, size_t)
+TUNABLE_CALLBACK_FNDECL (set_deterministic_arenas, int32_t)
 #else
 /* Initialization routine. */
 #include <string.h>
@@ -285,6 +332,39 @@ extern struct dl_open_hook *_dl_open_hook;
 libc_hidden_proto (_dl_open_hook);
 #endif
 
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+/* Returns the creation index of the calling thread, which is the same in
+   every variant, or -1 if we do not run under the MVEE.  */
+static long
+mvee_get_thread_num (void)
+{
+#ifdef MVEE_GET_THREAD_NUM
+  INTERNAL_SYSCALL_DECL (err);
+  long res = INTERNAL_SYSCALL_NCS (MVEE_GET_THREAD_NUM, err, 0);
+  if (!INTERNAL_SYSCALL_ERROR_P (res, err))
+    return res;
+#endif
+  return -1;
+}
+
+/* Called from ptmalloc_init if glibc.malloc.deterministic_arenas is set.
+   Natively, threads need not get the same arenas in every run, so we keep
+   the regular arena selection.  */
+static void
+deterministic_arenas_init (void)
+{
+  if (mvee_get_thread_num () < 0)
+    {
+      mp_.deterministic_arenas = 0;
+      return;
+    }
+
+  deterministic_arenas[0] = &main_arena;
+  main_arena.mmap_threshold = mp_.mmap_threshold;
+  main_arena.trim_threshold = mp_.trim_threshold;
+}
+
 static void
 ptmalloc_init (void)
 {
@@ -325,6 +405,8 @@ ptmalloc_init (void)
 	       TUNABLE_CALLBACK (set_tcache_unsorted_limit));
 # endif
   TUNABLE_GET (mxfast, size_t, TUNABLE_CALLBACK (set_mxfast));
+  TUNABLE_GET (deterministic_arenas, int32_t,
+	       TUNABLE_CALLBACK (set_deterministic_arenas));
 #else
   const char *s = NULL;
   if (__glibc_likely (_environ != NULL))
@@ -392,6 +474,14 @@ ptmalloc_init (void)
     __malloc_check_init ();
 #endif
 
+  if (mp_.deterministic_arenas)
+    deterministic_arenas_init ();
+
+  /* Natively, mapping heaps one at a time costs no more than carving them
+     from a pool, and leaves more address space for everything else.  The
+     answer is cached, so this does not cost another monitor round-trip.  */
+  heap_pool_enabled = mvee_detect_monitor ();
+
 #if HAVE_MALLOC_INIT_HOOK
   void (*hook) (void) = atomic_forced_read (__malloc_initialize_hook);
   if (hook != NULL)
@@ -446,6 +536,68 @@ dump_heap (heap_info *heap)
    multiple threads, but only one will succeed.  */
 static char *aligned_heap_area;
 
+/* Reserve the next part of the heap pool.  heap_pool_lock must be held and
+   the pool must be empty.  Like new_heap, we announce a reservation of
+   POOL_SIZE bytes, map twice that and keep an aligned POOL_SIZE part, which
+   is what the monitor expects.  If the variants do not all get an aligned
+   pool, they disable the pool together and go back to mapping heaps one at
+   a time, rather than retry on every new heap.  */
+static void
+heap_pool_grow (void)
+{
+  size_t pool_size = heap_pool_heaps * HEAP_MAX_SIZE;
+  char *p1, *p2;
+  unsigned long ul;
+
+  (void) mvee_all_heaps_aligned (0, pool_size);
+  p1 = (char *) MMAP (0, pool_size << 1, PROT_NONE, MAP_NORESERVE);
+  if (p1 == MAP_FAILED)
+    return;
+
+  p2 = (char *) (((unsigned long) p1 + (HEAP_MAX_SIZE - 1))
+                 & ~(HEAP_MAX_SIZE - 1));
+  ul = p2 - p1;
+  if (ul)
+    __munmap (p1, ul);
+  __munmap (p2 + pool_size, pool_size - ul);
+
+  if (!mvee_all_heaps_aligned (p2, pool_size))
+    {
+      __munmap (p2, pool_size);
+      heap_pool_enabled = 0;
+      return;
+    }
+
+  heap_pool = p2;
+  heap_pool_end = p2 + pool_size;
+  if (heap_pool_heaps < HEAP_POOL_MAX_HEAPS)
+    heap_pool_heaps <<= 1;
+}
+
+/* Take a HEAP_MAX_SIZE aligned PROT_NONE heap from the pool.  Returns
+   MAP_FAILED if we do not use the pool or it could not grow.  */
+static char *
+heap_pool_get (void)
+{
+  char *p = MAP_FAILED;
+
+  if (!heap_pool_enabled)
+    return p;
+
+  __libc_lock_lock (heap_pool_lock);
+  /* Another thread may have disabled the pool while we waited.  */
+  if (heap_pool == heap_pool_end && heap_pool_enabled)
+    heap_pool_grow ();
+  if (heap_pool != heap_pool_end)
+    {
+      p = heap_pool;
+      heap_pool += HEAP_MAX_SIZE;
+    }
+  __libc_lock_unlock (heap_pool_lock);
+
+  return p;
+}
+
 /* Create a new heap.  size is automatically rounded up to a multiple
    of the page size. */
 
@@ -471,9 +623,9 @@ new_heap (size_t size, size_t top_pad)
      No swap space needs to be reserved for the following large
      mapping (on Linux, this is the case for all non-writable mappings
      anyway). */
-  p2 = MAP_FAILED;
+  p2 = heap_pool_get ();
   prev_heap_area = atomic_load_acquire(&aligned_heap_area);
-  if (prev_heap_area)
+  if (p2 == MAP_FAILED && prev_heap_area)
     {
       p2 = (char *) MMAP (prev_heap_area, HEAP_MAX_SIZE, PROT_NONE,
                           MAP_NORESERVE);
@@ -640,8 +792,7 @@ heap_trim (heap_info *heap, size_t pad)
      and _int_free by preserving the top pad and rounding down to the nearest
      page.  */
   top_size = chunksize (top_chunk);
-  if ((unsigned long)(top_size) <
-      (unsigned long)(atomic_load_relaxed(&mp_.trim_threshold)))
+  if ((unsigned long)(top_size) < arena_trim_threshold (ar_ptr))
     return 0;
 
   top_area = top_size - MINSIZE - 1;
@@ -684,8 +835,10 @@ detach_arena (mstate replaced_arena)
     }
 }
 
+/* Allocates and initializes a new arena, without attaching it to a thread
+   or adding it to the list of arenas.  */
 static mstate
-_int_new_arena (size_t size)
+alloc_new_arena (size_t size)
 {
   mstate a;
   heap_info *h;
@@ -718,13 +871,16 @@ _int_new_arena (size_t size)
   set_head (top (a), (((char *) h + h->size) - ptr) | PREV_INUSE);
 
   LIBC_PROBE (memory_arena_new, 2, a, size);
-  mstate replaced_arena = thread_arena;
-  thread_arena = a;
   __libc_lock_init (a->mutex);
 
-  __libc_lock_lock (list_lock);
+  return a;
+}
 
-  /* Add the new arena to the global list.  */
+/* Add arena A to the global list.  list_lock must have been acquired by
+   the caller.  */
+static void
+link_new_arena (mstate a)
+{
   struct malloc_state* tmp = atomic_load_relaxed(&main_arena.next);
   atomic_store_relaxed(&a->next, tmp);
   /* FIXME: The barrier is an attempt to synchronize with read access
@@ -732,7 +888,20 @@ _int_new_arena (size_t size)
      traversing the list.  */
   atomic_write_barrier ();
   atomic_store_relaxed(&main_arena.next, a);
+}
 
+static mstate
+_int_new_arena (size_t size)
+{
+  mstate a = alloc_new_arena (size);
+  if (a == NULL)
+    return 0;
+
+  mstate replaced_arena = thread_arena;
+  thread_arena = a;
+
+  __libc_lock_lock (list_lock);
+  link_new_arena (a);
   __libc_lock_unlock (list_lock);
 
   __libc_lock_lock (free_list_lock);
@@ -749,7 +918,7 @@ _int_new_arena (size_t size)
      but this could result in a deadlock with
      __malloc_fork_lock_parent.  */
 
-  __libc_lock_lock (a->mutex);
+  arena_mutex_lock (a);
 
   return a;
 }
@@ -778,7 +947,7 @@ get_free_list (void)
       if (result != NULL)
         {
           LIBC_PROBE (memory_arena_reuse_free_list, 1, result);
-          __libc_lock_lock (result->mutex);
+          arena_mutex_lock (result);
 	  thread_arena = result;
         }
 
@@ -837,7 +1006,7 @@ reused_arena (mstate avoid_arena)
 
   /* No arena available without contention.  Wait for the next in line.  */
   LIBC_PROBE (memory_arena_reuse_wait, 3, &result->mutex, result, avoid_arena);
-  __libc_lock_lock (result->mutex);
+  arena_mutex_lock (result);
 
 out:
   /* Attach the arena to the current thread.  */
@@ -870,6 +1039,51 @@ out:
   return result;
 }
 
+/* Lock and return the arena for the calling thread in deterministic arena
+   mode, creating it if needed.  Returns NULL if the thread's arena is
+   AVOID_ARENA or could not be created, which the callers treat like a
+   failure to create a new arena.  */
+static mstate
+deterministic_arena_get (size_t size, mstate avoid_arena)
+{
+  long num = mvee_get_thread_num ();
+  mstate a;
+
+  __libc_lock_lock (list_lock);
+  if (deterministic_arena_count == 0)
+    {
+      size_t count = mp_.arena_max;
+      if (count == 0)
+        {
+          int n = __get_nprocs ();
+          count = NARENAS_FROM_NCORES (n >= 1 ? n : 2);
+        }
+      deterministic_arena_count = MIN (count, DETERMINISTIC_ARENAS_MAX);
+    }
+
+  size_t slot = num < 0 ? 0 : num % deterministic_arena_count;
+  a = deterministic_arenas[slot];
+  if (a == NULL)
+    {
+      a = alloc_new_arena (size);
+      if (a != NULL)
+        {
+          a->mmap_threshold = mp_.mmap_threshold;
+          a->trim_threshold = mp_.trim_threshold;
+          link_new_arena (a);
+          deterministic_arenas[slot] = a;
+        }
+    }
+  __libc_lock_unlock (list_lock);
+
+  if (a == NULL || a == avoid_arena)
+    return NULL;
+
+  arena_mutex_lock (a);
+  thread_arena = a;
+  return a;
+}
+
 static mstate
 arena_get2 (size_t size, mstate avoid_arena)
 {
@@ -877,6 +1091,9 @@ arena_get2 (size_t size, mstate avoid_arena)
 
   static size_t narenas_limit;
 
+  if (mp_.deterministic_arenas)
+    return deterministic_arena_get (size, avoid_arena);
+
   a = get_free_list ();
   if (a == NULL)
     {
@@ -932,7 +1149,7 @@ arena_get_retry (mstate ar_ptr, size_t bytes)
     {
       __libc_lock_unlock (ar_ptr->mutex);
       ar_ptr = &main_arena;
-      __libc_lock_lock (ar_ptr->mutex);
+      arena_mutex_lock (ar_ptr);
     }
   else
     {
@@ -954,7 +1171,8 @@ __malloc_arena_thread_freeres (void)
   mstate a = thread_arena;
   thread_arena = NULL;
 
-  if (a != NULL)
+  /* Deterministic arenas stay assigned to their thread numbers.  */
+  if (a != NULL && !mp_.deterministic_arenas)
     {
       __libc_lock_lock (free_list_lock);
       /* If this was the last attached thread for this arena, put the
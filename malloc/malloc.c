@@ -996,6 +996,7 @@ typedef struct malloc_chunk* mchunkptr;
 
 static void*  _int_malloc(mstate, size_t);
 static void     _int_free(mstate, mchunkptr, int);
+static void     _int_free_chunk(mstate, mchunkptr, INTERNAL_SIZE_T, int);
 static void*  _int_realloc(mstate, mchunkptr, INTERNAL_SIZE_T,
 			   INTERNAL_SIZE_T);
 static void*  _int_memalign(mstate, size_t, size_t);
@@ -1716,6 +1717,15 @@ struct malloc_state
   /* Memory allocated from the system in this arena.  */
   INTERNAL_SIZE_T system_mem;
   INTERNAL_SIZE_T max_system_mem;
+
+  /* The dynamic thresholds of this arena, with deterministic arenas.
+     Access to these fields is serialized by mutex.  */
+  unsigned long trim_threshold;
+  INTERNAL_SIZE_T mmap_threshold;
+
+  /* Number of times mutex was acquired to allocate or free memory.  Only
+     updated with mutex held.  */
+  unsigned long lock_count;
 };
 
 /* 
@@ -1754,6 +1764,11 @@ struct malloc_par
   /* First address handed out by MORECORE/sbrk.  */
   char *sbrk_base; /* stijn: racy - but probably impossible to trigger the race... */
 
+  /* Assign arenas to threads by their MVEE thread number.  Only set at
+     startup.  With deterministic arenas, trim_threshold and mmap_threshold
+     are just the initial thresholds for every arena.  */
+  int deterministic_arenas;
+
 #if USE_TCACHE
   /* Maximum number of buckets to use.  */
   size_t tcache_bins;
@@ -1842,6 +1857,21 @@ malloc_init_state (mstate av)
   av->top = initial_top (av);
 }
 
+/* The thresholds that apply to arena AV, which may be NULL.  With
+   deterministic arenas, every arena adjusts its own thresholds under its
+   mutex, unless they were fixed with mallopt, so these reads need not be
+   ordered across variants.  */
+#define arena_trim_threshold(av)					      \
+  ((unsigned long) (mp_.deterministic_arenas && (av) != NULL		      \
+		    && !mp_.no_dyn_threshold				      \
+		    ? (av)->trim_threshold				      \
+		    : atomic_load_relaxed (&mp_.trim_threshold)))
+#define arena_mmap_threshold(av)					      \
+  ((unsigned long) (mp_.deterministic_arenas && (av) != NULL		      \
+		    && !mp_.no_dyn_threshold				      \
+		    ? (av)->mmap_threshold				      \
+		    : atomic_load_relaxed (&mp_.mmap_threshold)))
+
 /*
    Other internal utilities operating on mstates
  */
@@ -2317,7 +2347,7 @@ sysmalloc (INTERNAL_SIZE_T nb, mstate av)
    */
 
   if (av == NULL
-      || ((unsigned long) (nb) >= (unsigned long) (atomic_load_relaxed(&mp_.mmap_threshold))
+      || ((unsigned long) (nb) >= arena_mmap_threshold (av)
 		  && (atomic_load_acquire(&mp_.n_mmaps) < mp_.n_mmaps_max)))
     {
       char *mm;           /* return value from mmap call*/
@@ -2973,6 +3003,35 @@ tcache_get (size_t tc_idx)
   return (void *) e;
 }
 
+/* Free chunk P of arena AV, for which tcache bin TC_IDX is full, along
+   with half of the chunks in that bin, so that the next frees of this
+   size need not lock an arena either.  The cached chunks may come from
+   other arenas.  Every run of chunks from the same arena is freed under
+   a single acquisition of its mutex.  */
+static void
+tcache_flush (mstate av, mchunkptr p, size_t tc_idx)
+{
+  arena_mutex_lock (av);
+  _int_free_chunk (av, p, chunksize (p), 1);
+
+  for (size_t n = mp_.tcache_count / 2;
+       n > 0 && tcache->entries[tc_idx] != NULL; n--)
+    {
+      mchunkptr victim = mem2chunk (tcache_get (tc_idx));
+      mstate ar_ptr = arena_for_chunk (victim);
+
+      if (ar_ptr != av)
+	{
+	  __libc_lock_unlock (av->mutex);
+	  av = ar_ptr;
+	  arena_mutex_lock (av);
+	}
+      _int_free_chunk (av, victim, chunksize (victim), 1);
+    }
+
+  __libc_lock_unlock (av->mutex);
+}
+
 static void
 tcache_thread_shutdown (void)
 {
@@ -3115,6 +3174,31 @@ __libc_malloc (size_t bytes)
 }
 libc_hidden_def (__libc_malloc)
 
+/* With deterministic arenas, freeing mmapped chunk P adjusts the dynamic
+   thresholds of the calling thread's arena rather than the global ones, so
+   that the order in which threads free such chunks cannot make variants
+   pick different thresholds.  */
+static void
+update_arena_dyn_thresholds (mchunkptr p)
+{
+  mstate av = thread_arena;
+
+  if (av == NULL || mp_.no_dyn_threshold
+      || chunksize_nomask (p) > DEFAULT_MMAP_THRESHOLD_MAX
+      || DUMPED_MAIN_ARENA_CHUNK (p))
+    return;
+
+  arena_mutex_lock (av);
+  if (chunksize_nomask (p) > av->mmap_threshold)
+    {
+      av->mmap_threshold = chunksize (p);
+      av->trim_threshold = 2 * av->mmap_threshold;
+      LIBC_PROBE (memory_mallopt_free_dyn_thresholds, 2,
+		  av->mmap_threshold, av->trim_threshold);
+    }
+  __libc_lock_unlock (av->mutex);
+}
+
 void
 __libc_free (void *mem)
 {
@@ -3138,7 +3222,9 @@ __libc_free (void *mem)
     {
       /* See if the dynamic brk/mmap threshold needs adjusting.
 	 Dumped fake mmapped chunks do not affect the threshold.  */
-      if (!atomic_load_relaxed(&mp_.no_dyn_threshold)
+      if (mp_.deterministic_arenas)
+	update_arena_dyn_thresholds (p);
+      else if (!atomic_load_relaxed(&mp_.no_dyn_threshold)
           && chunksize_nomask (p) > atomic_load_relaxed(&mp_.mmap_threshold)
           && chunksize_nomask (p) <= DEFAULT_MMAP_THRESHOLD_MAX
 	  && !DUMPED_MAIN_ARENA_CHUNK (p))
@@ -3264,7 +3350,7 @@ __libc_realloc (void *oldmem, size_t bytes)
       return newp;
     }
 
-  __libc_lock_lock (ar_ptr->mutex);
+  arena_mutex_lock (ar_ptr);
 
   newp = _int_realloc (ar_ptr, oldp, oldsize, nb);
 
@@ -4141,6 +4227,27 @@ _int_malloc (mstate av, size_t bytes)
 
       if ((unsigned long) (size) >= (unsigned long) (nb + MINSIZE))
         {
+#if USE_TCACHE
+          /* None of the bins had chunks of this size to stash in the
+             tcache either.  Split them off top instead, while we hold the
+             lock, so that the next allocations of this size need not lock
+             the arena.  */
+          if (tcache_nb)
+            {
+              while (tcache->counts[tc_idx] < mp_.tcache_count
+                     && (unsigned long) (size)
+                        >= (unsigned long) (2 * nb + MINSIZE))
+                {
+                  mchunkptr tc_victim = victim;
+
+                  victim = chunk_at_offset (tc_victim, nb);
+                  size -= nb;
+                  set_head (tc_victim, nb | PREV_INUSE |
+                            (av != &main_arena ? NON_MAIN_ARENA : 0));
+                  tcache_put (tc_victim, tc_idx);
+                }
+            }
+#endif
           remainder_size = size - nb;
           remainder = chunk_at_offset (victim, nb);
           av->top = remainder;
@@ -4187,13 +4294,6 @@ static void
 _int_free (mstate av, mchunkptr p, int have_lock)
 {
   INTERNAL_SIZE_T size;        /* its size */
-  mfastbinptr *fb;             /* associated fastbin */
-  mchunkptr nextchunk;         /* next contiguous chunk */
-  INTERNAL_SIZE_T nextsize;    /* its size */
-  int nextinuse;               /* true if nextchunk is used */
-  INTERNAL_SIZE_T prevsize;    /* size of previous contiguous chunk */
-  mchunkptr bck;               /* misc temp for linking */
-  mchunkptr fwd;               /* misc temp for linking */
 
   size = chunksize (p);
 
@@ -4241,10 +4341,36 @@ _int_free (mstate av, mchunkptr p, int have_lock)
 	    tcache_put (p, tc_idx);
 	    return;
 	  }
+
+	/* The bin is full.  Chunks that go to the fastbins do not need
+	   the lock, but for any other chunk, make the lock we have to take
+	   anyway count for part of the bin as well.  */
+	if (!have_lock && !SINGLE_THREAD_P
+	    && (unsigned long) (size) > (unsigned long) (get_max_fast ())
+	    && !chunk_is_mmapped (p))
+	  {
+	    tcache_flush (av, p, tc_idx);
+	    return;
+	  }
       }
   }
 #endif
 
+  _int_free_chunk (av, p, size, have_lock);
+}
+
+/* Return chunk P of SIZE bytes to arena AV, bypassing the tcache.  */
+static void
+_int_free_chunk (mstate av, mchunkptr p, INTERNAL_SIZE_T size, int have_lock)
+{
+  mfastbinptr *fb;             /* associated fastbin */
+  mchunkptr nextchunk;         /* next contiguous chunk */
+  INTERNAL_SIZE_T nextsize;    /* its size */
+  int nextinuse;               /* true if nextchunk is used */
+  INTERNAL_SIZE_T prevsize;    /* size of previous contiguous chunk */
+  mchunkptr bck;               /* misc temp for linking */
+  mchunkptr fwd;               /* misc temp for linking */
+
   /*
     If eligible, place chunk on a fastbin so it can be found
     and used quickly in malloc.
@@ -4272,7 +4398,7 @@ _int_free (mstate av, mchunkptr p, int have_lock)
 	   getting the lock.  */
 	if (!have_lock)
 	  {
-	    __libc_lock_lock (av->mutex);
+	    arena_mutex_lock (av);
 	    fail = (chunksize_nomask (chunk_at_offset (p, size)) <= 2 * SIZE_SZ
 		    || chunksize (chunk_at_offset (p, size)) >= av->system_mem);
 	    __libc_lock_unlock (av->mutex);
@@ -4332,7 +4458,7 @@ _int_free (mstate av, mchunkptr p, int have_lock)
       have_lock = true;
 
     if (!have_lock)
-      __libc_lock_lock (av->mutex);
+      arena_mutex_lock (av);
 
     nextchunk = chunk_at_offset(p, size);
 
@@ -4434,8 +4560,7 @@ _int_free (mstate av, mchunkptr p, int have_lock)
 
       if (av == &main_arena) {
 #ifndef MORECORE_CANNOT_TRIM
-	if ((unsigned long)(chunksize(av->top)) >=
-	    (unsigned long)(atomic_load_relaxed(&mp_.trim_threshold)))
+	if ((unsigned long)(chunksize(av->top)) >= arena_trim_threshold (av))
 	  systrim(mp_.top_pad, av);
 #endif
       } else {
@@ -5115,6 +5240,13 @@ do_set_arena_max (size_t value)
   return 1;
 }
 
+static __always_inline int
+do_set_deterministic_arenas (int32_t value)
+{
+  mp_.deterministic_arenas = value != 0;
+  return 1;
+}
+
 #if USE_TCACHE
 static __always_inline int
 do_set_tcache_max (size_t value)
@@ -5425,6 +5557,7 @@ __malloc_info (int options, FILE *fp)
   size_t total_max_system = 0;
   size_t total_aspace = 0;
   size_t total_aspace_mprotect = 0;
+  unsigned long total_locks = 0;
 
 
 
@@ -5535,6 +5668,8 @@ __malloc_info (int options, FILE *fp)
 	  while (heap != NULL);
 	}
 
+      unsigned long locks = ar_ptr->lock_count;
+
       __libc_lock_unlock (ar_ptr->mutex);
 
       total_nfastblocks += nfastblocks;
@@ -5557,14 +5692,16 @@ __malloc_info (int options, FILE *fp)
 
       total_system += ar_ptr->system_mem;
       total_max_system += ar_ptr->max_system_mem;
+      total_locks += locks;
 
       fprintf (fp,
 	       "</sizes>\n<total type=\"fast\" count=\"%zu\" size=\"%zu\"/>\n"
 	       "<total type=\"rest\" count=\"%zu\" size=\"%zu\"/>\n"
 	       "<system type=\"current\" size=\"%zu\"/>\n"
-	       "<system type=\"max\" size=\"%zu\"/>\n",
+	       "<system type=\"max\" size=\"%zu\"/>\n"
+	       "<locks count=\"%lu\"/>\n",
 	       nfastblocks, fastavail, nblocks, avail,
-	       ar_ptr->system_mem, ar_ptr->max_system_mem);
+	       ar_ptr->system_mem, ar_ptr->max_system_mem, locks);
 
       if (ar_ptr != &main_arena)
 	{
@@ -5599,11 +5736,12 @@ __malloc_info (int options, FILE *fp)
 	   "<system type=\"max\" size=\"%zu\"/>\n"
 	   "<aspace type=\"total\" size=\"%zu\"/>\n"
 	   "<aspace type=\"mprotect\" size=\"%zu\"/>\n"
+	   "<locks count=\"%lu\"/>\n"
 	   "</malloc>\n",
 	   total_nfastblocks, total_fastavail, total_nblocks, total_avail,
 		   atomic_load_relaxed(&mp_.n_mmaps), atomic_load_relaxed(&mp_.mmapped_mem),
 	   total_system, total_max_system,
-	   total_aspace, total_aspace_mprotect);
+	   total_aspace, total_aspace_mprotect, total_locks);
 
   return 0;
 }
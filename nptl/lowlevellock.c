@@ -17,6 +17,7 @@
    License along with the GNU C Library; if not, see
    <https://www.gnu.org/licenses/>.  */
 
+#include <errno.h>
 #include <sysdep.h>
 #include <lowlevellock.h>
 #include <atomic.h>
@@ -53,3 +54,140 @@ __lll_lock_wait (int *futex, int private)
     }
 }
 #endif
+
+
+#ifdef MVEE_LOCK_REPLICATED
+/* Lock-level replication under the MVEE (glibc.mvee.lock_replication).  The
+   leader acquires and releases its locks with the original atomics and tells
+   the sync agent about it afterwards.  The followers wait for their turn and
+   then take or drop the lock without contending for it.  See
+   csu/mvee-woc-agent.c.
+
+   A follower always sets its copy of the lock to 1: it never sleeps on the
+   lock itself, and it learns from the leader whether an unlock has to wake a
+   waiter.  The futex waits it repeats therefore return right away.  */
+
+/* Acquires FUTEX with the original atomics, like __lll_lock (VAL 1) or
+   __lll_cond_lock (VAL 2).  Returns the number of futex waits it took.  */
+static unsigned int
+lll_lock_native (int *futex, int val, int private)
+{
+  unsigned int waits = 0;
+
+  if (!orig_atomic_compare_and_exchange_bool_acq (futex, val, 0))
+    return 0;
+
+  if (orig_atomic_load_relaxed (futex) == 2)
+    goto futex;
+
+  while (orig_atomic_exchange_acq (futex, 2) != 0)
+    {
+    futex:
+      waits++;
+      lll_futex_wait (futex, 2, private);
+    }
+
+  return waits;
+}
+
+void
+__lll_lock_replicated (int *futex, int val, int private)
+{
+  unsigned long turn;
+  unsigned int waits;
+
+  if (mvee_lock_replay (futex, &turn, &waits) < 0)
+    waits = lll_lock_native (futex, val, private);
+  else
+    {
+      for (unsigned int i = 0; i < waits; i++)
+	lll_futex_wait (futex, 2, private);
+      orig_atomic_store_relaxed (futex, 1);
+    }
+
+  if (turn)
+    mvee_lock_acquired (turn, futex, waits);
+}
+
+int
+__lll_trylock_replicated (int *futex, int val)
+{
+  unsigned long turn;
+  unsigned int waits;
+  int err = mvee_lock_replay (futex, &turn, &waits);
+
+  if (err > 0)
+    return 1;
+
+  if (err < 0)
+    {
+      if (orig_atomic_compare_and_exchange_bool_acq (futex, val, 0))
+	{
+	  if (turn)
+	    mvee_lock_failed (EBUSY, 0);
+	  return 1;
+	}
+    }
+  else
+    orig_atomic_store_relaxed (futex, 1);
+
+  if (turn)
+    mvee_lock_acquired (turn, futex, 0);
+  return 0;
+}
+
+void
+__lll_unlock_replicated (int *futex, int private)
+{
+  /* Don't touch the lock after releasing it, see __lll_unlock.  */
+  unsigned long turn = mvee_lock_release (futex);
+  int oldval = orig_atomic_exchange_rel (futex, 0);
+
+  if (turn ? mvee_lock_released (turn, oldval) : oldval > 1)
+    lll_futex_wake (futex, 1, private);
+}
+
+/* This function doesn't get included in libc.  */
+# if IS_IN (libpthread)
+int
+__lll_clocklock_replicated (int *futex, clockid_t clockid,
+			    const struct timespec *abstime, int private)
+{
+  unsigned long turn;
+  unsigned int waits;
+  int val = mvee_lock_replay (futex, &turn, &waits);
+
+  if (val < 0)
+    {
+      val = 0;
+      if (orig_atomic_compare_and_exchange_bool_acq (futex, 1, 0))
+	while (orig_atomic_exchange_acq (futex, 2) != 0)
+	  {
+	    val = __lll_clocklock_wait (futex, 2, clockid, abstime, private);
+	    /* These don't get as far as the futex call.  */
+	    if (val == EINVAL || val == ETIMEDOUT)
+	      break;
+	    waits++;
+	  }
+
+      if (turn && val != 0)
+	mvee_lock_failed (val, waits);
+    }
+  else
+    {
+      /* Make exactly the futex calls the leader made.  __lll_clocklock_wait
+	 would read our own clock, and could skip or add one.  The timeout
+	 doesn't matter since our lock word is never 2.  */
+      struct timespec ts = { 0, 0 };
+      for (unsigned int i = 0; i < waits; i++)
+	lll_futex_timed_wait (futex, 2, abstime != NULL ? &ts : NULL, private);
+      if (val == 0)
+	orig_atomic_store_relaxed (futex, 1);
+    }
+
+  if (turn && val == 0)
+    mvee_lock_acquired (turn, futex, waits);
+  return val;
+}
+# endif
+#endif
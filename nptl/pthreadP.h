@@ -116,22 +116,35 @@ enum
 #define PTHREAD_MUTEX_PSHARED_BIT 128
 
 /* See concurrency notes regarding __kind in struct __pthread_mutex_s
-   in sysdeps/nptl/bits/thread-shared-types.h.  */
+   in sysdeps/nptl/bits/thread-shared-types.h.  With lock-level replication
+   under the MVEE (see lowlevellock.h), the lock word is all we replicate for
+   the mutex types that use the low-level lock.  Apart from FORCE_ELISION,
+   __kind is only written before the mutex is shared, so every variant loads
+   the same value.  FORCE_ELISION is off while locks are replicated (see
+   force-elision.h).  */
+#if defined MVEE_LOCK_REPLICATED && (IS_IN (libc) || IS_IN (libpthread))
+# define PTHREAD_MUTEX_KIND(m) \
+  (__glibc_unlikely (mvee_lock_replication)				      \
+   ? orig_atomic_load_relaxed (&((m)->__data.__kind))			      \
+   : atomic_load_relaxed (&((m)->__data.__kind)))
+#else
+# define PTHREAD_MUTEX_KIND(m) \
+  atomic_load_relaxed (&((m)->__data.__kind))
+#endif
+
 #define PTHREAD_MUTEX_TYPE(m) \
-  (atomic_load_relaxed (&((m)->__data.__kind)) & 127)
+  (PTHREAD_MUTEX_KIND (m) & 127)
 /* Don't include NO_ELISION, as that type is always the same
    as the underlying lock type.  */
 #define PTHREAD_MUTEX_TYPE_ELISION(m) \
-  (atomic_load_relaxed (&((m)->__data.__kind))	\
-   & (127 | PTHREAD_MUTEX_ELISION_NP))
+  (PTHREAD_MUTEX_KIND (m) & (127 | PTHREAD_MUTEX_ELISION_NP))
 
 #if LLL_PRIVATE == 0 && LLL_SHARED == 128
 # define PTHREAD_MUTEX_PSHARED(m) \
-  (atomic_load_relaxed (&((m)->__data.__kind)) & 128)
+  (PTHREAD_MUTEX_KIND (m) & 128)
 #else
 # define PTHREAD_MUTEX_PSHARED(m) \
-  ((atomic_load_relaxed (&((m)->__data.__kind)) & 128)	\
-   ? LLL_SHARED : LLL_PRIVATE)
+  ((PTHREAD_MUTEX_KIND (m) & 128) ? LLL_SHARED : LLL_PRIVATE)
 #endif
 
 /* The kernel when waking robust mutexes on exit never uses
@@ -385,6 +385,13 @@ START_THREAD_DEFN
   /* Initialize pointers to locale data.  */
   __ctype_init ();
 
+#ifdef MVEE_GET_THREAD_CONTROL
+  /* Have the MVEE set up this thread's replication buffers in one go,
+     before the first synchronization operation below.  */
+  if (__glibc_unlikely (mvee_hooks_enabled))
+    mvee_thread_bootstrap ();
+#endif
+
   /* Allow setxid from now onwards.  */
   if (__glibc_unlikely (atomic_exchange_acq (&pd->setxid_futex, 0) == -2))
     futex_wake (&pd->setxid_futex, 1, FUTEX_PRIVATE);
@@ -490,6 +497,13 @@ START_THREAD_DEFN
   /* Clean up any state libc stored in thread-local variables.  */
   __libc_thread_freeres ();
 
+#ifdef MVEE_GET_THREAD_CONTROL
+  /* Under the MVEE, finish the SHM operations this thread still holds
+     back before it goes away.  */
+  if (__glibc_unlikely (mvee_hooks_enabled))
+    mvee_thread_teardown ();
+#endif
+
   /* If this is the last thread we terminate the process now.  We
      do not notify the debugger, it might just irritate it if there
      is no thread left.  */
@@ -104,6 +104,11 @@ extern void mvee_atomic_postop_internal (unsigned char preop_result);
 extern int  mvee_should_sync_tid        (void);
 extern int  mvee_all_heaps_aligned      (char* heap, unsigned long alloc_size); 
 extern void mvee_xcheck                 (unsigned long item);
+extern int  mvee_register_private_range   (const void* start, unsigned long len);
+extern void mvee_unregister_private_range (const void* start);
+extern void mvee_thread_bootstrap         (void);
+extern void mvee_thread_teardown          (void);
+extern unsigned char mvee_hooks_enabled;
 
 #define MVEE_POSTOP() \
   mvee_atomic_postop_internal(__tmp_mvee_preop);
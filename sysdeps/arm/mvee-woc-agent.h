@@ -1,16 +1,23 @@
+#include <mvee-call-site.h>
+
 #define MVEE_MAX_COUNTERS 65536
 
 #define MVEE_MALLOC_HOOK(type, msg, sz, ar_ptr, chunk_ptr)
 
 extern void          mvee_atomic_postop_internal (unsigned char preop_result);
-extern unsigned char mvee_atomic_preop_internal  (volatile void* word_ptr);
+extern unsigned char mvee_atomic_preop_internal  (unsigned short op_type, volatile void* word_ptr, unsigned int call_site);
 extern int           mvee_should_sync_tid        (void);
 extern int           mvee_all_heaps_aligned      (char* heap, unsigned long alloc_size); 
 extern void          mvee_invalidate_buffer      (void);
 extern unsigned char mvee_should_futex_unlock    (void);
+extern int           mvee_register_private_range   (const void* start, unsigned long len);
+extern void          mvee_unregister_private_range (const void* start);
+extern void          mvee_thread_bootstrap         (void);
+extern void          mvee_thread_teardown          (void);
+extern unsigned char mvee_hooks_enabled;
 
 #define MVEE_POSTOP()								\
 	mvee_atomic_postop_internal(__tmp_mvee_preop);
 
 #define MVEE_PREOP(op_type, mem, is_store)								\
-	register unsigned char  __tmp_mvee_preop = mvee_atomic_preop_internal(mem);
+	register unsigned char  __tmp_mvee_preop = mvee_atomic_preop_internal(op_type, mem, MVEE_CALL_SITE);
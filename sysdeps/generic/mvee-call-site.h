@@ -0,0 +1,19 @@
+#ifndef _MVEE_CALL_SITE_H
+#define _MVEE_CALL_SITE_H
+
+//
+// MVEE_CALL_SITE identifies the call site of a replicated operation: the
+// source line the atomic was expanded on, and the length of the file name.
+// This is a constant, so passing it costs a single register load, and it is
+// the same in every variant regardless of where the code was loaded. The
+// followers compare their own with the leader's when
+// glibc.mvee.call_site_checks is set.
+//
+// This is a fingerprint, not a unique id: two files whose names have the same
+// length collide at the same line, and lines above 2^20 wrap. A mismatch
+// always means a divergence, but a match doesn't prove the variants are at
+// the same call site.
+//
+#define MVEE_CALL_SITE ((unsigned int) __LINE__ | ((unsigned int) sizeof (__FILE__) << 20))
+
+#endif /* _MVEE_CALL_SITE_H */
@@ -60,12 +60,34 @@
    FUTEX_WAITERS     - possibly has waiters
    FUTEX_OWNER_DIED  - owning user has exited without releasing the futex.  */
 
+/* Under the MVEE with glibc.mvee.lock_replication, the sync agent replicates
+   the locks of libc and libpthread as a whole rather than every atomic
+   operation on them.  Every operation on such a lock must then go through
+   the __lll_*_replicated functions in nptl/lowlevellock.c.  */
+#if defined MVEE_LOCK_REPLICATED && (IS_IN (libc) || IS_IN (libpthread))
+# define MVEE_LLL_REPLICATED(futex) MVEE_LOCK_REPLICATED (futex)
+#else
+# define MVEE_LLL_REPLICATED(futex) 0
+#endif
+
+/* Only defined when MVEE_LLL_REPLICATED can be true.  */
+extern void __lll_lock_replicated (int *futex, int val, int private)
+  attribute_hidden;
+extern int __lll_trylock_replicated (int *futex, int val) attribute_hidden;
+extern int __lll_clocklock_replicated (int *futex, clockid_t,
+				       const struct timespec *,
+				       int private) attribute_hidden;
+extern void __lll_unlock_replicated (int *futex, int private)
+  attribute_hidden;
+
 
 /* If LOCK is 0 (not acquired), set to 1 (acquired with no waiters) and return
    0.  Otherwise leave lock unchanged and return non-zero to indicate that the
    lock was not acquired.  */
 #define __lll_trylock(lock)	\
-  __glibc_unlikely (atomic_compare_and_exchange_bool_acq ((lock), 1, 0))
+  (MVEE_LLL_REPLICATED (lock)						      \
+   ? __lll_trylock_replicated ((lock), 1)				      \
+   : __glibc_unlikely (atomic_compare_and_exchange_bool_acq ((lock), 1, 0)))
 #define lll_trylock(lock)	\
    __lll_trylock (&(lock))
 
@@ -73,7 +95,9 @@
    return 0.  Otherwise leave lock unchanged and return non-zero to indicate
    that the lock was not acquired.  */
 #define lll_cond_trylock(lock)	\
-  __glibc_unlikely (atomic_compare_and_exchange_bool_acq (&(lock), 2, 0))
+  (MVEE_LLL_REPLICATED (&(lock))					      \
+   ? __lll_trylock_replicated (&(lock), 2)				      \
+   : __glibc_unlikely (atomic_compare_and_exchange_bool_acq (&(lock), 2, 0)))
 
 extern void __lll_lock_wait_private (int *futex) attribute_hidden;
 extern void __lll_lock_wait (int *futex, int private) attribute_hidden;
@@ -92,8 +116,10 @@ extern void __lll_lock_wait (int *futex, int private) attribute_hidden;
   ((void)                                                               \
    ({                                                                   \
      int *__futex = (futex);                                            \
-     if (__glibc_unlikely                                               \
-         (atomic_compare_and_exchange_bool_acq (__futex, 1, 0)))        \
+     if (MVEE_LLL_REPLICATED (__futex))                                 \
+       __lll_lock_replicated (__futex, 1, private);                     \
+     else if (__glibc_unlikely                                          \
+              (atomic_compare_and_exchange_bool_acq (__futex, 1, 0)))   \
        {                                                                \
          if (__builtin_constant_p (private) && (private) == LLL_PRIVATE) \
            __lll_lock_wait_private (__futex);                           \
@@ -116,7 +142,9 @@ extern void __lll_lock_wait (int *futex, int private) attribute_hidden;
   ((void)                                                               \
    ({                                                                   \
      int *__futex = (futex);                                            \
-     if (__glibc_unlikely (atomic_exchange_acq (__futex, 2) != 0))      \
+     if (MVEE_LLL_REPLICATED (__futex))                                 \
+       __lll_lock_replicated (__futex, 2, private);                     \
+     else if (__glibc_unlikely (atomic_exchange_acq (__futex, 2) != 0)) \
        __lll_lock_wait (__futex, private);                              \
    }))
 #define lll_cond_lock(futex, private) __lll_cond_lock (&(futex), private)
@@ -137,8 +165,11 @@ extern int __lll_clocklock_wait (int *futex, int val, clockid_t,
     int *__futex = (futex);                                     \
     int __val = 0;                                              \
                                                                 \
-    if (__glibc_unlikely                                        \
-        (atomic_compare_and_exchange_bool_acq (__futex, 1, 0))) \
+    if (MVEE_LLL_REPLICATED (__futex))                          \
+      __val = __lll_clocklock_replicated (__futex, clockid,     \
+                                          abstime, private);    \
+    else if (__glibc_unlikely                                   \
+             (atomic_compare_and_exchange_bool_acq (__futex, 1, 0))) \
       {								\
 	while (atomic_exchange_acq (futex, 2) != 0)		\
 	  {							\
@@ -171,9 +202,14 @@ extern int __lll_clocklock_wait (int *futex, int val, clockid_t,
    ({                                                   \
      int *__futex = (futex);                            \
      int __private = (private);                         \
-     int __oldval = atomic_exchange_rel (__futex, 0);   \
-     if (__glibc_unlikely (__oldval > 1))               \
-       lll_futex_wake (__futex, 1, __private);          \
+     if (MVEE_LLL_REPLICATED (__futex))                 \
+       __lll_unlock_replicated (__futex, __private);    \
+     else                                               \
+       {                                                \
+         int __oldval = atomic_exchange_rel (__futex, 0); \
+         if (__glibc_unlikely (__oldval > 1))           \
+           lll_futex_wake (__futex, 1, __private);      \
+       }                                                \
    }))
 #define lll_unlock(futex, private)	\
   __lll_unlock (&(futex), private)
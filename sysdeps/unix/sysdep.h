@@ -88,9 +88,23 @@
 #define INLINE_SYSCALL_CALL(...) \
   __INLINE_SYSCALL_DISP (__INLINE_SYSCALL, __VA_ARGS__)
 
+/* Under the MVEE, the SHM agent can hold back stores to shared memory,
+   and the followers' checks of them.  They must be done before a syscall
+   can pass data based on them on to other processes.  */
+#if !defined __ASSEMBLER__ && (IS_IN (libc) || IS_IN (libpthread))
+extern unsigned char mvee_shm_syscall_hook;
+extern void mvee_shm_syscall_boundary (void);
+# define MVEE_SYSCALL_BOUNDARY() \
+  (__glibc_unlikely (mvee_shm_syscall_hook)				     \
+   ? mvee_shm_syscall_boundary () : (void) 0)
+#else
+# define MVEE_SYSCALL_BOUNDARY() ((void) 0)
+#endif
+
 #define SYSCALL_CANCEL(...) \
   ({									     \
     long int sc_ret;							     \
+    MVEE_SYSCALL_BOUNDARY ();						     \
     if (SINGLE_THREAD_P) 						     \
       sc_ret = INLINE_SYSCALL_CALL (__VA_ARGS__); 			     \
     else								     \
@@ -107,6 +121,7 @@
 #define INTERNAL_SYSCALL_CANCEL(...) \
   ({									     \
     long int sc_ret;							     \
+    MVEE_SYSCALL_BOUNDARY ();						     \
     if (SINGLE_THREAD_P) 						     \
       sc_ret = INTERNAL_SYSCALL_CALL (__VA_ARGS__); 			     \
     else								     \
@@ -25,6 +25,8 @@
 void
 _exit (int status)
 {
+  MVEE_SYSCALL_BOUNDARY ();
+
   while (1)
     {
 #ifdef __NR_exit_group
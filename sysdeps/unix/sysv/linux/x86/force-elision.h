@@ -16,9 +16,19 @@
    License along with the GNU C Library; if not, see
    <https://www.gnu.org/licenses/>.  */
 
+/* Under the MVEE, elided locks bypass lock-level replication, and
+   enabling elision here writes __kind while the mutex is shared.  Don't
+   force elision while locks are replicated.  */
+#if defined MVEE_LOCK_REPLICATED && IS_IN (libpthread)
+# define FORCE_ELISION_ENABLED \
+  (__pthread_force_elision && !mvee_lock_replication)
+#else
+# define FORCE_ELISION_ENABLED __pthread_force_elision
+#endif
+
 /* Automatically enable elision for existing user lock kinds.  */
 #define FORCE_ELISION(m, s)						\
-  if (__pthread_force_elision)						\
+  if (FORCE_ELISION_ENABLED)						\
     {									\
       /* See concurrency notes regarding __kind in			\
 	 struct __pthread_mutex_s in					\
@@ -588,6 +588,8 @@ typedef uintmax_t uatomic_max_t;
 #define MVEE_GET_VIRTUALIZED_ARGV0      MVEE_FAKE_SYSCALL_BASE + 17
 #define MVEE_GET_LEADER_SHM_TAG         MVEE_FAKE_SYSCALL_BASE + 20
 #define MVEE_RESET_ATFORK               MVEE_FAKE_SYSCALL_BASE + 21
+#define MVEE_REGISTER_STATS_PAGE        MVEE_FAKE_SYSCALL_BASE + 22
+#define MVEE_GET_THREAD_CONTROL         MVEE_FAKE_SYSCALL_BASE + 23
 #define MVEE_LIBC_LOCK_BUFFER           3
 #define MVEE_LIBC_MALLOC_DEBUG_BUFFER   11
 #define MVEE_LIBC_ATOMIC_BUFFER         13
@@ -1156,9 +1158,8 @@ enum mvee_extended_atomics {
 //
 #define atomic_load_relaxed(mem)					\
 	({												\
-		MVEE_PREOP(ATOMIC_LOAD, mem, 0);			\
-		__typeof(*mem) ____result = orig_atomic_load_relaxed(mem);	\
-		MVEE_POSTOP();								\
+		__typeof(*mem) ____result;					\
+		MVEE_LOAD(ATOMIC_LOAD, mem, ____result, orig_atomic_load_relaxed(mem)); \
 		____result;									\
 	})
 
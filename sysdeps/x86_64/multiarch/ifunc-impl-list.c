@@ -23,6 +23,9 @@
 #include <sysdep.h>
 #include "init-arch.h"
 
+extern size_t __mvee_find_mismatch (const void *a, const void *b,
+				   size_t size) attribute_hidden;
+
 /* Maximum number of IFUNC implementations.  */
 #define MAX_IFUNC	5
 
@@ -123,6 +126,14 @@ __libc_ifunc_impl_list (const char *name, struct libc_ifunc_impl *array,
 			      __memrchr_avx2)
 	      IFUNC_IMPL_ADD (array, i, memrchr, 1, __memrchr_sse2))
 
+  /* Support sysdeps/x86_64/multiarch/mvee-find-mismatch.c.  */
+  IFUNC_IMPL (i, name, __mvee_find_mismatch,
+	      IFUNC_IMPL_ADD (array, i, __mvee_find_mismatch,
+			      HAS_ARCH_FEATURE (AVX2_Usable),
+			      __mvee_find_mismatch_avx2)
+	      IFUNC_IMPL_ADD (array, i, __mvee_find_mismatch, 1,
+			      __mvee_find_mismatch_sse2))
+
 #ifdef SHARED
   /* Support sysdeps/x86_64/multiarch/memset_chk.c.  */
   IFUNC_IMPL (i, name, __memset_chk,
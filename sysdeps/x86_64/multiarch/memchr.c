@@ -29,6 +29,7 @@
 libc_ifunc_redirected (__redirect_memchr, orig_memchr, IFUNC_SELECTOR ());
 
 extern __typeof (orig_memchr) mvee_shm_memchr;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 void *
 mvee_memchr (void const *s, int c_in, size_t n)
@@ -39,9 +40,14 @@ mvee_memchr (void const *s, int c_in, size_t n)
   return orig_memchr(s, c_in, n);
 }
 
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_memchr, mvee_public_memchr,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memchr : IFUNC_SELECTOR ());
+
 # ifdef SHARED
-__hidden_ver1 (mvee_memchr, __GI_memchr, __redirect_memchr)
+__hidden_ver1 (mvee_public_memchr, __GI_memchr, __redirect_memchr)
   __attribute__((visibility ("hidden"))) __attribute_copy__ (orig_memchr);
 # endif
-strong_alias(mvee_memchr, memchr)
+strong_alias(mvee_public_memchr, memchr)
 #endif
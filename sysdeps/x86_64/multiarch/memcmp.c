@@ -29,6 +29,7 @@
 libc_ifunc_redirected (__redirect_memcmp, orig_memcmp, IFUNC_SELECTOR ());
 
 extern __typeof (orig_memcmp) mvee_shm_memcmp;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 int
 mvee_memcmp (const void *s1, const void *s2, size_t len)
@@ -38,12 +39,17 @@ mvee_memcmp (const void *s1, const void *s2, size_t len)
   return orig_memcmp(s1, s2, len);
 }
 
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_memcmp, mvee_public_memcmp,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memcmp : IFUNC_SELECTOR ());
+
 # undef bcmp
-weak_alias (mvee_memcmp, bcmp)
+weak_alias (mvee_public_memcmp, bcmp)
 
 # ifdef SHARED
-__hidden_ver1 (mvee_memcmp, __GI_memcmp, __redirect_memcmp)
-  __attribute__ ((visibility ("hidden"))) __attribute_copy__ (mvee_memcmp);
+__hidden_ver1 (mvee_public_memcmp, __GI_memcmp, __redirect_memcmp)
+  __attribute__ ((visibility ("hidden"))) __attribute_copy__ (mvee_public_memcmp);
 # endif
-strong_alias(mvee_memcmp, memcmp)
+strong_alias(mvee_public_memcmp, memcmp)
 #endif
@@ -30,6 +30,7 @@ libc_ifunc_redirected (__redirect_memcpy, orig_memcpy,
 		       IFUNC_SELECTOR ());
 
 extern __typeof (orig_memcpy) mvee_shm_memcpy;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 void *
 mvee_memcpy (void *__restrict dest, const void *__restrict src, size_t n)
@@ -42,11 +43,17 @@ mvee_memcpy (void *__restrict dest, const void *__restrict src, size_t n)
   return orig_memcpy(dest, src, n);
 }
 
+/* Natively, no pointer carries the SHM tag, so we bind the public symbols
+   straight to the selected implementation.  */
+libc_ifunc_redirected (__redirect_memcpy, mvee_public_memcpy,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memcpy : IFUNC_SELECTOR ());
+
 # ifdef SHARED
-__hidden_ver1 (mvee_memcpy, __GI_memcpy, __redirect_memcpy)
+__hidden_ver1 (mvee_public_memcpy, __GI_memcpy, __redirect_memcpy)
   __attribute__ ((visibility ("hidden")));
 # endif
 
 # include <shlib-compat.h>
-versioned_symbol (libc, mvee_memcpy, memcpy, GLIBC_2_14);
+versioned_symbol (libc, mvee_public_memcpy, memcpy, GLIBC_2_14);
 #endif
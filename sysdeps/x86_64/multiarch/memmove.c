@@ -30,6 +30,7 @@ libc_ifunc_redirected (__redirect_memmove, orig_memmove,
 		       IFUNC_SELECTOR ());
 
 extern __typeof (orig_memmove) mvee_shm_memmove;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 void *
 mvee_memmove (void *dest, const void * src, size_t n)
@@ -42,11 +43,16 @@ mvee_memmove (void *dest, const void * src, size_t n)
   return orig_memmove(dest, src, n);
 }
 
-strong_alias (mvee_memmove, __libc_memmove);
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_memmove, mvee_public_memmove,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memmove : IFUNC_SELECTOR ());
+
+strong_alias (mvee_public_memmove, __libc_memmove);
 
 # ifdef SHARED
-__hidden_ver1 (mvee_memmove, __GI_memmove, __redirect_memmove)
+__hidden_ver1 (mvee_public_memmove, __GI_memmove, __redirect_memmove)
   __attribute__ ((visibility ("hidden")));
 # endif
-strong_alias(mvee_memmove, memmove)
+strong_alias(mvee_public_memmove, memmove)
 #endif
@@ -30,7 +30,23 @@
 # define SYMBOL_NAME mempcpy
 # include "ifunc-memmove.h"
 
-libc_ifunc_redirected (__redirect_mempcpy, __mempcpy, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_mempcpy, orig_mempcpy, IFUNC_SELECTOR ());
+
+extern __typeof (orig_mempcpy) mvee_shm_mempcpy;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+void *
+mvee_mempcpy (void *dest, const void *src, size_t n)
+{
+  if (((unsigned long)dest & 0x8000000000000000ull) || ((unsigned long)src & 0x8000000000000000ull))
+    return mvee_shm_mempcpy(dest, src, n);
+  return orig_mempcpy(dest, src, n);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_mempcpy, __mempcpy,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_mempcpy : IFUNC_SELECTOR ());
 
 weak_alias (__mempcpy, mempcpy)
 # ifdef SHARED
@@ -26,6 +26,22 @@
 # define SYMBOL_NAME memrchr
 # include "ifunc-avx2.h"
 
-libc_ifunc_redirected (__redirect_memrchr, __memrchr, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_memrchr, orig_memrchr, IFUNC_SELECTOR ());
+
+extern __typeof (orig_memrchr) mvee_shm_memrchr;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+void *
+mvee_memrchr (const void *s, int c, size_t n)
+{
+  if ((unsigned long)s & 0x8000000000000000ull)
+    return mvee_shm_memrchr(s, c, n);
+  return orig_memrchr(s, c, n);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_memrchr, __memrchr,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memrchr : IFUNC_SELECTOR ());
 weak_alias (__memrchr, memrchr)
 #endif
@@ -29,6 +29,7 @@
 libc_ifunc_redirected (__redirect_memset, orig_memset, IFUNC_SELECTOR ());
 
 extern __typeof (orig_memset) mvee_shm_memset;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 void *
 mvee_memset (void *dest, int ch, size_t len)
@@ -39,9 +40,14 @@ mvee_memset (void *dest, int ch, size_t len)
   return orig_memset(dest, ch, len);
 }
 
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_memset, mvee_public_memset,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_memset : IFUNC_SELECTOR ());
+
 # ifdef SHARED
-__hidden_ver1 (mvee_memset, __GI_memset, __redirect_memset)
+__hidden_ver1 (mvee_public_memset, __GI_memset, __redirect_memset)
   __attribute__ ((visibility ("hidden"))) __attribute_copy__ (orig_memset);
 # endif
-strong_alias(mvee_memset, memset)
+strong_alias(mvee_public_memset, memset)
 #endif
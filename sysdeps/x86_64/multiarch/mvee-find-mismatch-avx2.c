@@ -0,0 +1,73 @@
+/* Find the first byte in which two buffers differ.  AVX2 version.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+#if IS_IN (libc)
+# include <immintrin.h>
+# include <stddef.h>
+
+extern size_t __mvee_find_mismatch_avx2 (const void *a, const void *b,
+					 size_t size) attribute_hidden;
+
+/* Compare 64 bytes per iteration.  Only once a block differs do we look
+   for the first differing lane in it.  */
+size_t
+__attribute__ ((section (".text.avx")))
+__mvee_find_mismatch_avx2 (const void *a, const void *b, size_t size)
+{
+  const unsigned char *pa = a;
+  const unsigned char *pb = b;
+  size_t offset = 0;
+  unsigned int mask;
+
+  for (; offset + 64 <= size; offset += 64)
+    {
+      __m256i eq0 = _mm256_cmpeq_epi8
+	(_mm256_loadu_si256 ((const __m256i *) (pa + offset)),
+	 _mm256_loadu_si256 ((const __m256i *) (pb + offset)));
+      __m256i eq1 = _mm256_cmpeq_epi8
+	(_mm256_loadu_si256 ((const __m256i *) (pa + offset + 32)),
+	 _mm256_loadu_si256 ((const __m256i *) (pb + offset + 32)));
+
+      if ((unsigned int) _mm256_movemask_epi8 (_mm256_and_si256 (eq0, eq1))
+	  == 0xffffffff)
+	continue;
+
+      mask = ~(unsigned int) _mm256_movemask_epi8 (eq0);
+      if (mask != 0)
+	return offset + __builtin_ctz (mask);
+      mask = ~(unsigned int) _mm256_movemask_epi8 (eq1);
+      return offset + 32 + __builtin_ctz (mask);
+    }
+
+  if (offset + 32 <= size)
+    {
+      mask = ~(unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8
+	(_mm256_loadu_si256 ((const __m256i *) (pa + offset)),
+	 _mm256_loadu_si256 ((const __m256i *) (pb + offset))));
+      if (mask != 0)
+	return offset + __builtin_ctz (mask);
+      offset += 32;
+    }
+
+  for (; offset < size; offset++)
+    if (pa[offset] != pb[offset])
+      return offset;
+
+  return size;
+}
+#endif
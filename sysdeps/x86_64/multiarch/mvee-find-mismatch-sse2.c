@@ -0,0 +1,5 @@
+#if IS_IN (libc)
+# define MVEE_FIND_MISMATCH __mvee_find_mismatch_sse2
+#endif
+
+#include <csu/mvee-find-mismatch.c>
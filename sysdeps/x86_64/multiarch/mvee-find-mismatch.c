@@ -0,0 +1,32 @@
+/* Multiple versions of __mvee_find_mismatch.
+   All versions must be listed in ifunc-impl-list.c.
+   Copyright (C) 2020 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+/* Define multiple versions only for the definition in libc.  */
+#if IS_IN (libc)
+# include <stddef.h>
+
+extern size_t __redirect_mvee_find_mismatch (const void *a, const void *b,
+					     size_t size);
+
+# define SYMBOL_NAME mvee_find_mismatch
+# include "ifunc-avx2.h"
+
+libc_ifunc_redirected (__redirect_mvee_find_mismatch, __mvee_find_mismatch,
+		       IFUNC_SELECTOR ());
+#endif
@@ -28,8 +28,23 @@
 # define SYMBOL_NAME rawmemchr
 # include "ifunc-avx2.h"
 
+libc_ifunc_redirected (__redirect_rawmemchr, orig_rawmemchr, IFUNC_SELECTOR ());
+
+extern __typeof (orig_rawmemchr) mvee_shm_rawmemchr;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+void *
+mvee_rawmemchr (const void *s, int c)
+{
+  if ((unsigned long)s & 0x8000000000000000ull)
+    return mvee_shm_rawmemchr(s, c);
+  return orig_rawmemchr(s, c);
+}
+
+/* See memcpy.c.  */
 libc_ifunc_redirected (__redirect_rawmemchr, __rawmemchr,
-		       IFUNC_SELECTOR ());
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_rawmemchr : IFUNC_SELECTOR ());
 weak_alias (__rawmemchr, rawmemchr)
 # ifdef SHARED
 __hidden_ver1 (__rawmemchr, __GI___rawmemchr, __redirect___rawmemchr)
@@ -30,7 +30,23 @@
 # define SYMBOL_NAME stpcpy
 # include "ifunc-strcpy.h"
 
-libc_ifunc_redirected (__redirect_stpcpy, __stpcpy, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_stpcpy, orig_stpcpy, IFUNC_SELECTOR ());
+
+extern __typeof (orig_stpcpy) mvee_shm_stpcpy;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+char *
+mvee_stpcpy (char *dest, const char *src)
+{
+  if (((unsigned long)dest & 0x8000000000000000ull) || ((unsigned long)src & 0x8000000000000000ull))
+    return mvee_shm_stpcpy(dest, src);
+  return orig_stpcpy(dest, src);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_stpcpy, __stpcpy,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_stpcpy : IFUNC_SELECTOR ());
 
 weak_alias (__stpcpy, stpcpy)
 # ifdef SHARED
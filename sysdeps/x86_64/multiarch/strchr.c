@@ -46,7 +46,23 @@ IFUNC_SELECTOR (void)
   return OPTIMIZE (sse2);
 }
 
-libc_ifunc_redirected (__redirect_strchr, strchr, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strchr, orig_strchr, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strchr) mvee_shm_strchr;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+char *
+mvee_strchr (const char *str, int c)
+{
+  if ((unsigned long)str & 0x8000000000000000ull)
+    return mvee_shm_strchr(str, c);
+  return orig_strchr(str, c);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strchr, strchr,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strchr : IFUNC_SELECTOR ());
 weak_alias (strchr, index)
 # ifdef SHARED
 __hidden_ver1 (strchr, __GI_strchr, __redirect_strchr)
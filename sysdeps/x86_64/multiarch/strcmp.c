@@ -53,6 +53,7 @@ IFUNC_SELECTOR (void)
 libc_ifunc_redirected (__redirect_strcmp, orig_strcmp, IFUNC_SELECTOR ());
 
 extern __typeof (orig_strcmp) mvee_shm_strcmp;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 int
 mvee_strcmp(const char *str1, const char *str2)
@@ -62,9 +63,14 @@ mvee_strcmp(const char *str1, const char *str2)
   return orig_strcmp(str1, str2);
 }
 
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strcmp, mvee_public_strcmp,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strcmp : IFUNC_SELECTOR ());
+
 # ifdef SHARED
-__hidden_ver1 (mvee_strcmp, __GI_strcmp, __redirect_strcmp)
-  __attribute__ ((visibility ("hidden"))) __attribute_copy__ (mvee_strcmp);
+__hidden_ver1 (mvee_public_strcmp, __GI_strcmp, __redirect_strcmp)
+  __attribute__ ((visibility ("hidden"))) __attribute_copy__ (mvee_public_strcmp);
 # endif
-strong_alias(mvee_strcmp, strcmp)
+strong_alias(mvee_public_strcmp, strcmp)
 #endif
@@ -26,7 +26,23 @@
 # define SYMBOL_NAME strcpy
 # include "ifunc-strcpy.h"
 
-libc_ifunc_redirected (__redirect_strcpy, strcpy, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strcpy, orig_strcpy, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strcpy) mvee_shm_strcpy;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+char *
+mvee_strcpy (char *dest, const char *src)
+{
+  if (((unsigned long)dest & 0x8000000000000000ull) || ((unsigned long)src & 0x8000000000000000ull))
+    return mvee_shm_strcpy(dest, src);
+  return orig_strcpy(dest, src);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strcpy, strcpy,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strcpy : IFUNC_SELECTOR ());
 
 # ifdef SHARED
 __hidden_ver1 (strcpy, __GI_strcpy, __redirect_strcpy)
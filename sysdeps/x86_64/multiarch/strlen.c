@@ -29,6 +29,7 @@
 libc_ifunc_redirected (__redirect_strlen, orig_strlen, IFUNC_SELECTOR ());
 
 extern __typeof (orig_strlen) mvee_shm_strlen;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
 
 size_t
 mvee_strlen (const char *str)
@@ -38,9 +39,14 @@ mvee_strlen (const char *str)
   return orig_strlen(str);
 }
 
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strlen, mvee_public_strlen,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strlen : IFUNC_SELECTOR ());
+
 # ifdef SHARED
-__hidden_ver1 (mvee_strlen, __GI_strlen, __redirect_strlen)
-  __attribute__((visibility ("hidden"))) __attribute_copy__ (mvee_strlen);
+__hidden_ver1 (mvee_public_strlen, __GI_strlen, __redirect_strlen)
+  __attribute__((visibility ("hidden"))) __attribute_copy__ (mvee_public_strlen);
 # endif
-strong_alias(mvee_strlen, strlen)
+strong_alias(mvee_public_strlen, strlen)
 #endif
@@ -51,7 +51,23 @@ IFUNC_SELECTOR (void)
   return OPTIMIZE (sse2);
 }
 
-libc_ifunc_redirected (__redirect_strncmp, strncmp, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strncmp, orig_strncmp, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strncmp) mvee_shm_strncmp;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+int
+mvee_strncmp (const char *str1, const char *str2, size_t n)
+{
+  if (((unsigned long)str1 & 0x8000000000000000ull) || ((unsigned long)str2 & 0x8000000000000000ull))
+    return mvee_shm_strncmp(str1, str2, n);
+  return orig_strncmp(str1, str2, n);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strncmp, strncmp,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strncmp : IFUNC_SELECTOR ());
 
 # ifdef SHARED
 __hidden_ver1 (strncmp, __GI_strncmp, __redirect_strncmp)
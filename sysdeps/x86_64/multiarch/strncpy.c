@@ -26,7 +26,23 @@
 # define SYMBOL_NAME strncpy
 # include "ifunc-strcpy.h"
 
-libc_ifunc_redirected (__redirect_strncpy, strncpy, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strncpy, orig_strncpy, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strncpy) mvee_shm_strncpy;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+char *
+mvee_strncpy (char *dest, const char *src, size_t n)
+{
+  if (((unsigned long)dest & 0x8000000000000000ull) || ((unsigned long)src & 0x8000000000000000ull))
+    return mvee_shm_strncpy(dest, src, n);
+  return orig_strncpy(dest, src, n);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strncpy, strncpy,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strncpy : IFUNC_SELECTOR ());
 
 # ifdef SHARED
 __hidden_ver1 (strncpy, __GI_strncpy, __redirect_strncpy)
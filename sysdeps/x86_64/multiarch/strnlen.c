@@ -28,7 +28,23 @@
 # define SYMBOL_NAME strnlen
 # include "ifunc-avx2.h"
 
-libc_ifunc_redirected (__redirect_strnlen, __strnlen, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strnlen, orig_strnlen, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strnlen) mvee_shm_strnlen;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+size_t
+mvee_strnlen (const char *str, size_t maxlen)
+{
+  if ((unsigned long)str & 0x8000000000000000ull)
+    return mvee_shm_strnlen(str, maxlen);
+  return orig_strnlen(str, maxlen);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strnlen, __strnlen,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strnlen : IFUNC_SELECTOR ());
 weak_alias (__strnlen, strnlen);
 # ifdef SHARED
 __hidden_ver1 (__strnlen, __GI___strnlen, __redirect___strnlen)
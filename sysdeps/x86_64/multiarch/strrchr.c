@@ -25,7 +25,23 @@
 # define SYMBOL_NAME strrchr
 # include "ifunc-avx2.h"
 
-libc_ifunc_redirected (__redirect_strrchr, strrchr, IFUNC_SELECTOR ());
+libc_ifunc_redirected (__redirect_strrchr, orig_strrchr, IFUNC_SELECTOR ());
+
+extern __typeof (orig_strrchr) mvee_shm_strrchr;
+extern unsigned char mvee_detect_monitor (void) attribute_hidden;
+
+char *
+mvee_strrchr (const char *str, int c)
+{
+  if ((unsigned long)str & 0x8000000000000000ull)
+    return mvee_shm_strrchr(str, c);
+  return orig_strrchr(str, c);
+}
+
+/* See memcpy.c.  */
+libc_ifunc_redirected (__redirect_strrchr, strrchr,
+		       mvee_detect_monitor ()
+		       ? (void *) mvee_strrchr : IFUNC_SELECTOR ());
 weak_alias (strrchr, rindex);
 # ifdef SHARED
 __hidden_ver1 (strrchr, __GI_strrchr, __redirect_strrchr)
@@ -1,3 +1,5 @@
+#include <mvee-call-site.h>
+
 //
 // MVEE_PARTIAL_ORDER_REPLICATION: when defined, slaves will use
 // queue projection to replay synchronization operations in
@@ -8,10 +10,13 @@
 //
 #define MVEE_PARTIAL_ORDER_REPLICATION
 //
-// MVEE_LOG_EIPS: when defined, libc logs return addresses for
-// all locking operations into a seperate queue
+// The checks that used to be enabled with MVEE_CHECK_LOCK_TYPE and
+// MVEE_LOG_EIPS are now selected at startup with glibc.mvee.check_level.
+//
+// MVEE_STACK_DEPTH: the number of return addresses we log per operation
+// at MVEE_CHECK_FULL.
 //
-// WARNING: enabling EIP logging _CAN_ trigger crashes! We're
+// WARNING: logging return addresses _CAN_ trigger crashes! We're
 // using __builtin_return_address(2) to fetch the eip of the 
 // caller of the locking function. Unfortunately, libc uses inline
 // __libc_lock_* operations every now and then. When it does, 
@@ -19,19 +24,7 @@
 // cases (e.g. in do_system) it might try to fetch the eip beyond
 // the end of the stack!
 //
-#define MVEE_LOG_EIPS
 #define MVEE_STACK_DEPTH 5
-//
-// MVEE_CHECK_LOCK_TYPE: if this is defined, the slave will check
-// whether or not it's replaying a lock of the same type
-// (only works with the extended queue)
-//
-#define MVEE_CHECK_LOCK_TYPE
-//
-// MVEE_DEBUG_MALLOC: if this is defined, the slaves will check whether
-// their malloc behavior is synced with the master
-//
-#define MVEE_DEBUG_MALLOC
 
 //
 // Latest version of the replication buffer layout:
@@ -42,7 +35,26 @@
 // struct mvee_buffer_entry for replicated operation <0>
 // ...
 // struct mvee_buffer_entry for replication operation <number of requested slots - 1>
+// tag map for variant <0>
+// ...
+// tag map for variant <N>
+// thread head table (partial order only)
+//
+// A tag map holds one byte per buffer entry, rounded up to a multiple of 64
+// bytes. A variant tags an entry in its own map once it has completed the
+// operation in it. Each variant only ever reads and writes its own map, so
+// tagging doesn't touch the cache lines the master logs its operations into,
+// nor the maps of the other variants. The MVEE clears the maps along with the
+// rest of the buffer when it is flushed.
+//
+// The thread head table has MVEE_THREAD_HEAD_BUCKETS unsigned ints. The master
+// hashes its thread ids into it, and stores 1 + the index of the first
+// operation in the buffer by any thread in each bucket, so a slave thread can
+// find its first operation after a flush without scanning the whole buffer.
+// The MVEE clears it along with the rest of the buffer.
 //
+#define MVEE_THREAD_HEAD_BITS    10
+#define MVEE_THREAD_HEAD_BUCKETS (1 << MVEE_THREAD_HEAD_BITS)
 
 //
 // The callstack buffer is separate and is just laid out like:
@@ -59,9 +71,10 @@
 
 struct mvee_buffer_info
 {
-	// The master must acquire this lock before writing into the buffer
+	// Unused. Master threads reserve slots by incrementing pos
 	volatile int lock;
-    // In the master, pos is the index of the next element we're going to write
+    // In the master, pos is the index of the next element we're going to reserve.
+    // It can temporarily exceed size while the buffer is being flushed
     // In the slave, pos is the index of the first element that hasn't been replicated yet
 	volatile unsigned int pos;
 	// How many elements fit inside the buffer?
@@ -83,12 +96,23 @@ struct mvee_buffer_entry
 	unsigned long word_ptr;
 	// the thread id of the master variant thread that accessed the field
 	unsigned int master_thread_id;
+	// partial order only: index of the next operation by the same master thread.
+	// The master fills this in when it logs that operation. 0 if there is none yet
+	unsigned int next_pos;
+	// partial order only: 1 + index of the previous operation on the same word
+	// (or on a word in the same hash bucket). 0 if there is none in this buffer
+	unsigned int prev_word_pos;
+	// MVEE_CALL_SITE of the operation
+	unsigned int call_site;
 	// type of the operation
 	unsigned short operation_type;
-	// Pad to the next cache line boundary. We use this to write tags in the partial order buffer
-	unsigned char tags[64 - sizeof(long) - sizeof(int) - sizeof(short)];
+	// Pad to the next cache line boundary, so master threads don't share lines
+	unsigned char padding[64 - sizeof(long) - sizeof(int) * 4 - sizeof(short)];
 };
 
+// The slot count and the tag map layout assume one entry per cache line
+_Static_assert(sizeof(struct mvee_buffer_entry) == 64, "mvee_buffer_entry must fill exactly one cache line");
+
 struct mvee_callstack_entry
 {
     // might be zero
@@ -100,10 +124,29 @@ extern void mvee_atomic_postop_internal (unsigned char preop_result);
 extern int  mvee_should_sync_tid        (void);
 extern int  mvee_all_heaps_aligned      (char* heap, unsigned long alloc_size); 
 extern void mvee_xcheck                 (unsigned long item);
+extern int  mvee_register_private_range   (const void* start, unsigned long len);
+extern void mvee_unregister_private_range (const void* start);
+extern void mvee_thread_bootstrap         (void);
+extern void mvee_thread_teardown          (void);
+extern unsigned char mvee_hooks_enabled;
 
+// Natively, the hooks boil down to a load and a predicted-not-taken branch
+// on mvee_hooks_enabled. The flag never changes once we're multithreaded.
 #define MVEE_POSTOP() \
-  mvee_atomic_postop_internal(__tmp_mvee_preop);
+  if (__glibc_unlikely(mvee_hooks_enabled)) \
+    mvee_atomic_postop_internal(__tmp_mvee_preop);
+
+extern unsigned char     mvee_atomic_preop_internal (unsigned short op_type, void* word_ptr, unsigned int call_site);
 
-extern unsigned char     mvee_atomic_preop_internal (unsigned short op_type, void* word_ptr);
 #define MVEE_PREOP(op_type, mem, is_store)					\
-	register unsigned char __tmp_mvee_preop = mvee_atomic_preop_internal(op_type, (void*)mem);
+	register unsigned char __tmp_mvee_preop =				\
+		__glibc_unlikely(mvee_hooks_enabled) ?				\
+		mvee_atomic_preop_internal(op_type, (void*)mem, MVEE_CALL_SITE) : 0;
+
+// This agent always orders load-only atomics
+#define MVEE_LOAD(op_type, mem, result, load)				\
+	do {													\
+		MVEE_PREOP(op_type, mem, 0);						\
+		result = load;										\
+		MVEE_POSTOP();										\
+	} while (0)
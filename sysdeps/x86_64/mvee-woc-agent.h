@@ -1,16 +1,87 @@
+#include <mvee-call-site.h>
+
 #define MVEE_MAX_COUNTERS 65536
 
 #define MVEE_MALLOC_HOOK(type, msg, sz, ar_ptr, chunk_ptr)
 
 extern void          mvee_atomic_postop_internal (unsigned char preop_result);
-extern unsigned char mvee_atomic_preop_internal  (volatile void* word_ptr);
+extern unsigned char mvee_atomic_preop_internal  (unsigned short op_type, volatile void* word_ptr, unsigned int call_site);
 extern int           mvee_should_sync_tid        (void);
 extern int           mvee_all_heaps_aligned      (char* heap, unsigned long alloc_size); 
 extern void          mvee_invalidate_buffer      (void);
 extern unsigned char mvee_should_futex_unlock    (void);
+extern int           mvee_register_private_range   (const void* start, unsigned long len);
+extern void          mvee_unregister_private_range (const void* start);
+extern void          mvee_thread_bootstrap         (void);
+extern void          mvee_thread_teardown          (void);
+extern void          mvee_atomic_replicate_load    (volatile void* word_ptr, void* value, unsigned long size);
+extern unsigned char mvee_load_replication;
+extern int           mvee_lock_replay              (volatile void* lock, unsigned long* turn, unsigned int* waits);
+extern void          mvee_lock_acquired            (unsigned long turn, volatile void* lock, unsigned int waits);
+extern void          mvee_lock_failed              (int err, unsigned int waits);
+extern unsigned long mvee_lock_release             (volatile void* lock);
+extern int           mvee_lock_released            (unsigned long turn, int oldval);
+extern unsigned char mvee_lock_replication;
+extern unsigned char mvee_hooks_enabled;
 
+//
+// Natively, the hooks boil down to a load and a predicted-not-taken branch
+// on mvee_hooks_enabled. The flag never changes once we're multithreaded.
+//
 #define MVEE_POSTOP()								\
-	mvee_atomic_postop_internal(__tmp_mvee_preop);
+	if (__glibc_unlikely(mvee_hooks_enabled))		\
+		mvee_atomic_postop_internal(__tmp_mvee_preop);
 
 #define MVEE_PREOP(op_type, mem, is_store)								\
-	register unsigned char  __tmp_mvee_preop = mvee_atomic_preop_internal((volatile void*)mem);
+	register unsigned char  __tmp_mvee_preop =							\
+		__glibc_unlikely(mvee_hooks_enabled) ?							\
+		mvee_atomic_preop_internal(op_type, (volatile void*)mem, MVEE_CALL_SITE) : 0;
+
+// __builtin_classify_type result for pointers
+#define MVEE_POINTER_TYPE_CLASS 5
+
+//
+// Relaxed load-only atomics. With glibc.mvee.load_replication, the leader logs
+// the value it loaded and the followers use that instead. Pointers and SHM words
+// differ between variants, so loads of those are always ordered. Acquire loads
+// and forced reads don't come through here: a follower that got "initialized"
+// or "tid == 0" by value wouldn't wait for the stores that value depended on.
+//
+// For the same reason, libpthread always orders its relaxed loads. Barriers,
+// rwlocks and condvars follow them with atomic_thread_fence_acquire, and a
+// follower that got "round finished" by value would pass the fence before its
+// own threads did the stores the fence is meant to make visible.
+//
+#if IS_IN (libpthread)
+# define MVEE_LOAD_REPLICATION 0
+#else
+# define MVEE_LOAD_REPLICATION mvee_load_replication
+#endif
+
+#define MVEE_LOAD(op_type, mem, result, load)							\
+	do {																\
+		if (MVEE_LOAD_REPLICATION &&									\
+			__builtin_classify_type(result) != MVEE_POINTER_TYPE_CLASS && \
+			!((unsigned long)(mem) & 0x8000000000000000ull))			\
+		{																\
+			result = load;												\
+			mvee_atomic_replicate_load((volatile void*)(mem), &result, sizeof(result)); \
+		}																\
+		else															\
+		{																\
+			MVEE_PREOP(op_type, mem, 0);								\
+			result = load;												\
+			MVEE_POSTOP();												\
+		}																\
+	} while (0)
+
+//
+// Lock-level replication of the lll_lock words in libc and libpthread, with
+// glibc.mvee.lock_replication (see sysdeps/nptl/lowlevellock.h). SHM lock words
+// are always replicated one atomic at a time. MVEE_LOCK_LEADER is the turn
+// mvee_lock_replay hands out in the leader.
+//
+#define MVEE_LOCK_LEADER (~0ul)
+#define MVEE_LOCK_REPLICATED(futex)										\
+	(__glibc_unlikely(mvee_lock_replication) &&							\
+	 !((unsigned long)(futex) & 0x8000000000000000ull))